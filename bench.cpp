@@ -0,0 +1,334 @@
+// Runtime benchmark against snprintf, std::ostringstream and std::format.
+// Build and run with `make bench`; pass BENCH_ARGS=--benchmark_filter=... to select cases.
+#include "format.hpp"
+#include <new>
+#include <map>
+#include <ctime>
+#include <tuple>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <benchmark/benchmark.h>
+
+#if __has_include(<format>)
+#include <format>
+#endif
+
+#ifdef __cpp_lib_format
+#define STD_FORMAT(name, ...) BENCHMARK_CAPTURE(run, name/std_format, [] { return std::format(__VA_ARGS__).size(); });
+#else
+#define STD_FORMAT(name, ...)
+#endif
+
+static std::atomic<std::size_t> allocations {0};
+
+void *operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+// each case returns the number of bytes it produced
+template<typename F>
+void run(benchmark::State &state, F f)
+{
+    std::size_t bytes = 0;
+    auto before = allocations.load(std::memory_order_relaxed);
+    for (auto _ : state)
+    {
+        auto size = f();
+        benchmark::DoNotOptimize(size);
+        bytes += size;
+    }
+    state.SetBytesProcessed(bytes);
+    state.counters["allocs/op"] = benchmark::Counter(
+        allocations.load(std::memory_order_relaxed) - before, benchmark::Counter::kAvgIterations);
+}
+
+template<typename ...Args>
+std::size_t snprintf_size(const char *format, Args ...args)
+{
+    char buffer[512];
+    return std::snprintf(buffer, sizeof(buffer), format, args...);
+}
+
+template<typename ...Args>
+std::size_t ostream_size(Args &&...args)
+{
+    std::ostringstream os;
+    (os << ... << args);
+    return os.str().size();
+}
+
+// inputs are globals so the compiler cannot fold them into the patterns
+int integer = 123456789;
+unsigned uinteger = 0xdeadbeef;
+double real = 3.14159265358979;
+std::string text = "The quick brown fox jumps over the lazy dog";
+std::vector<int> numbers = {1, 22, 333, 4444, 55555, 666666, 7777777, 88888888};
+std::map<int, std::string> dictionary = {{1, "one"}, {2, "two"}, {3, "three"}};
+std::tuple<int, std::string, double> record = {42, "answer", 0.5};
+const char *level = "INFO";
+const char *file = "server.cpp";
+int line = 1234;
+std::vector<unsigned char> payload(1500, 0xa5);
+std::vector<std::tuple<int, std::string, double>> rows(1000, record);
+std::vector<int> snapshot(1 << 22, integer);
+
+// integers in every base
+BENCHMARK_CAPTURE(run, int_dec/fmt, [] { return fmt::format<"{}">(integer).size(); });
+BENCHMARK_CAPTURE(run, int_dec/snprintf, [] { return snprintf_size("%d", integer); });
+BENCHMARK_CAPTURE(run, int_dec/ostringstream, [] { return ostream_size(integer); });
+STD_FORMAT(int_dec, "{}", integer)
+
+BENCHMARK_CAPTURE(run, int_hex/fmt, [] { return fmt::format<"{:x}">(uinteger).size(); });
+BENCHMARK_CAPTURE(run, int_hex/snprintf, [] { return snprintf_size("%#x", uinteger); });
+BENCHMARK_CAPTURE(run, int_hex/ostringstream, [] { return ostream_size(std::showbase, std::hex, uinteger); });
+STD_FORMAT(int_hex, "{:#x}", uinteger)
+
+BENCHMARK_CAPTURE(run, int_oct/fmt, [] { return fmt::format<"{:o}">(uinteger).size(); });
+BENCHMARK_CAPTURE(run, int_oct/snprintf, [] { return snprintf_size("%#o", uinteger); });
+BENCHMARK_CAPTURE(run, int_oct/ostringstream, [] { return ostream_size(std::showbase, std::oct, uinteger); });
+STD_FORMAT(int_oct, "{:#o}", uinteger)
+
+BENCHMARK_CAPTURE(run, int_bin/fmt, [] { return fmt::format<"{:b}">(uinteger).size(); });
+STD_FORMAT(int_bin, "{:#b}", uinteger)
+
+// floats with and without precision
+BENCHMARK_CAPTURE(run, float/fmt, [] { return fmt::format<"{}">(real).size(); });
+BENCHMARK_CAPTURE(run, float/snprintf, [] { return snprintf_size("%.17g", real); });
+BENCHMARK_CAPTURE(run, float/ostringstream, [] { return ostream_size(std::setprecision(17), real); });
+STD_FORMAT(float, "{}", real)
+
+BENCHMARK_CAPTURE(run, float_precision/fmt, [] { return fmt::format<"{:.3}">(real).size(); });
+BENCHMARK_CAPTURE(run, float_precision/snprintf, [] { return snprintf_size("%.3f", real); });
+BENCHMARK_CAPTURE(run, float_precision/ostringstream, [] { return ostream_size(std::fixed, std::setprecision(3), real); });
+STD_FORMAT(float_precision, "{:.3f}", real)
+
+// width, fill and alignment
+BENCHMARK_CAPTURE(run, width/fmt, [] { return fmt::format<"{:*^16}">(integer).size(); });
+BENCHMARK_CAPTURE(run, width/snprintf, [] { return snprintf_size("%16d", integer); });
+BENCHMARK_CAPTURE(run, width/ostringstream, [] { return ostream_size(std::setfill('*'), std::setw(16), integer); });
+STD_FORMAT(width, "{:*^16}", integer)
+
+// strings
+BENCHMARK_CAPTURE(run, string/fmt, [] { return fmt::format<"<{}>">(text).size(); });
+BENCHMARK_CAPTURE(run, string/snprintf, [] { return snprintf_size("<%s>", text.c_str()); });
+BENCHMARK_CAPTURE(run, string/ostringstream, [] { return ostream_size('<', text, '>'); });
+STD_FORMAT(string, "<{}>", text)
+
+// containers and tuples, the baselines format the elements by hand
+BENCHMARK_CAPTURE(run, vector/fmt, [] { return fmt::format<"{}">(numbers).size(); });
+BENCHMARK_CAPTURE(run, vector/ostringstream, []
+{
+    std::ostringstream os;
+    os << '{';
+    for (std::size_t i = 0; i < numbers.size(); ++i)
+    {
+        os << (i ? ", " : "") << numbers[i];
+    }
+    os << '}';
+    return os.str().size();
+});
+
+BENCHMARK_CAPTURE(run, map/fmt, [] { return fmt::format<"{}">(dictionary).size(); });
+BENCHMARK_CAPTURE(run, map/ostringstream, []
+{
+    std::ostringstream os;
+    os << '{';
+    for (auto it = dictionary.begin(); it != dictionary.end(); ++it)
+    {
+        os << (it == dictionary.begin() ? "" : ", ") << it->first << ": " << it->second;
+    }
+    os << '}';
+    return os.str().size();
+});
+
+BENCHMARK_CAPTURE(run, tuple/fmt, [] { return fmt::format<"{}">(record).size(); });
+BENCHMARK_CAPTURE(run, tuple/snprintf, []
+{
+    return snprintf_size("(%d, %s, %g)", std::get<0>(record), std::get<1>(record).c_str(), std::get<2>(record));
+});
+BENCHMARK_CAPTURE(run, tuple/ostringstream, []
+{
+    return ostream_size('(', std::get<0>(record), ", ", std::get<1>(record), ", ", std::get<2>(record), ')');
+});
+
+// hex dump of a packet payload, with memcpy of the same output size as the floor
+BENCHMARK_CAPTURE(run, hex_dump/fmt, [] { return fmt::format<"{:x}">(payload).size(); });
+BENCHMARK_CAPTURE(run, hex_dump/snprintf, []
+{
+    std::string out(2 * payload.size() + 1, '\0');
+    for (std::size_t i = 0; i < payload.size(); ++i)
+    {
+        std::snprintf(out.data() + 2 * i, 3, "%02x", payload[i]);
+    }
+    return out.size() - 1;
+});
+BENCHMARK_CAPTURE(run, hex_dump/memcpy, []
+{
+    std::string out(2 * payload.size(), '\0');
+    std::memcpy(out.data(), payload.data(), payload.size());
+    std::memcpy(out.data() + payload.size(), payload.data(), payload.size());
+    return out.size();
+});
+
+// a mostly clean JSON string value, against escaping one character at a time
+std::string event = "GET /api/v1/users/12345/orders?limit=50&offset=100 HTTP/1.1 \"Mozilla/5.0 (X11; Linux x86_64)\"";
+
+BENCHMARK_CAPTURE(run, json_escape/fmt, [] { return fmt::format<"{:j}">(event).size(); });
+BENCHMARK_CAPTURE(run, json_escape/loop, []
+{
+    std::string out = "\"";
+    for (char chr : event)
+    {
+        if (chr == '"' || chr == '\\')
+        {
+            out += '\\';
+            out += chr;
+        }
+        else if (static_cast<unsigned char>(chr) < 0x20)
+        {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", chr);
+            out += escape;
+        }
+        else
+        {
+            out += chr;
+        }
+    }
+    out += '"';
+    return out.size();
+});
+
+// 1000 CSV rows, one format call per row against a single format_many
+BENCHMARK_CAPTURE(run, rows/fmt, []
+{
+    std::string out;
+    for (auto &[id, name, ratio] : rows)
+    {
+        out += fmt::format<"{},{},{}\n">(id, name, ratio);
+    }
+    return out.size();
+});
+BENCHMARK_CAPTURE(run, rows/fmt_many, []
+{
+    std::string out;
+    return fmt::format_many<"{},{},{}\n">(rows, "", out).size();
+});
+
+// a 4M element container on the calling thread and split across all cores
+BENCHMARK_CAPTURE(run, large_vector/serial, []
+{
+    fmt::set_container_parallelism({.threshold = SIZE_MAX});
+    return fmt::format<"{}">(snapshot).size();
+})->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(run, large_vector/parallel, []
+{
+    fmt::set_container_parallelism({.threshold = 1 << 20});
+    return fmt::format<"{}">(snapshot).size();
+})->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// a log timestamp with microseconds, against strftime plus the fraction by hand
+BENCHMARK_CAPTURE(run, timestamp/fmt, []
+{
+    auto now = std::chrono::floor<std::chrono::microseconds>(std::chrono::system_clock::now());
+    return fmt::format<"{:%Y-%m-%dT%H:%M:%S.%fZ}">(now).size();
+});
+BENCHMARK_CAPTURE(run, timestamp/strftime, []
+{
+    auto now = std::chrono::floor<std::chrono::microseconds>(std::chrono::system_clock::now());
+    auto seconds = std::chrono::floor<std::chrono::seconds>(now);
+    std::time_t time = std::chrono::system_clock::to_time_t(seconds);
+    std::tm tm;
+    gmtime_r(&time, &tm);
+    char buffer[64];
+    auto size = std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+    size += std::snprintf(buffer + size, sizeof(buffer) - size, ".%06dZ", static_cast<int>((now - seconds).count()));
+    return std::string(buffer, size).size();
+});
+
+// a long multi-field log line
+BENCHMARK_CAPTURE(run, log_line/fmt, []
+{
+    return fmt::format<"[{}] {}:{} request {3:#x} from {} took {5:.3}ms, {6}\n">(
+        level, file, line, uinteger, text, real, numbers.size()).size();
+});
+BENCHMARK_CAPTURE(run, log_line/snprintf, []
+{
+    return snprintf_size("[%s] %s:%d request %#x from %s took %.3fms, %zu\n",
+        level, file, line, uinteger, text.c_str(), real, numbers.size());
+});
+BENCHMARK_CAPTURE(run, log_line/ostringstream, []
+{
+    return ostream_size('[', level, "] ", file, ':', line, " request ", std::showbase, std::hex, uinteger, std::dec,
+        " from ", text, " took ", std::fixed, std::setprecision(3), real, "ms, ", numbers.size(), '\n');
+});
+STD_FORMAT(log_line, "[{}] {}:{} request {:#x} from {} took {:.3f}ms, {}\n",
+    level, file, line, uinteger, text, real, numbers.size())
+
+// a log line parsed back, against sscanf
+std::string scanned = fmt::format<"[{}] {}:{} request {3:#x} took {4}ms">(level, file, line, uinteger, real);
+
+BENCHMARK_CAPTURE(run, scan/fmt, []
+{
+    std::string_view lvl, source;
+    int number;
+    unsigned id;
+    double took;
+    fmt::scan<"[{}] {}:{} request {3:#x} took {4}ms">(scanned, lvl, source, number, id, took);
+    return scanned.size();
+});
+BENCHMARK_CAPTURE(run, scan/sscanf, []
+{
+    char lvl[16], source[64];
+    int number;
+    unsigned id;
+    double took;
+    std::sscanf(scanned.c_str(), "[%15[^]]] %63[^:]:%d request %x took %lfms", lvl, source, &number, &id, &took);
+    return scanned.size();
+});
+
+// the same line written to /dev/null with one system call per line, through
+// stdio and with writev
+constexpr fmt::fixed_string log_pattern {"[{}] {}:{} request {3:#x} from {} took {5:.3}ms, {6}\n"};
+std::size_t log_size = fmt::formatted_size<log_pattern>(level, file, line, uinteger, text, real, numbers.size());
+std::FILE *null_file = std::fopen("/dev/null", "w");
+int null_fd = open("/dev/null", O_WRONLY);
+
+BENCHMARK_CAPTURE(run, log_write/print, []
+{
+    fmt::print<log_pattern>(null_file, level, file, line, uinteger, text, real, numbers.size());
+    std::fflush(null_file);
+    return log_size;
+});
+BENCHMARK_CAPTURE(run, log_write/write, []
+{
+    fmt::write<log_pattern>(null_fd, level, file, line, uinteger, text, real, numbers.size());
+    return log_size;
+});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,34 @@
+// Compile-time benchmark: 1000 distinct patterns plus a handful of 4 KB ones.
+// Build with `make compile-bench` to see compile time and object size.
+#include "format.hpp"
+#include <string>
+
+#define PATTERN(n) "record " #n ": id={} name={1:>12} flags={2:#06x} ratio={3:.3}\n"
+#define LINE(n) out += fmt::format<PATTERN(n)>(n, "name", n##u, 0.5);
+
+#define LINES10(n) LINE(n##0) LINE(n##1) LINE(n##2) LINE(n##3) LINE(n##4) \
+                   LINE(n##5) LINE(n##6) LINE(n##7) LINE(n##8) LINE(n##9)
+#define LINES100(n) LINES10(n##0) LINES10(n##1) LINES10(n##2) LINES10(n##3) LINES10(n##4) \
+                    LINES10(n##5) LINES10(n##6) LINES10(n##7) LINES10(n##8) LINES10(n##9)
+
+#define CHUNK "field {0} = {1:>8} and {2:#x}, lorem ipsum dolor sit amet elit. "
+#define X4(s) s s s s
+#define X64(s) X4(X4(X4(s)))
+#define LONG_LINE(n) out += fmt::format<#n X64(CHUNK)>(n, "value", n##u);
+
+void part_1(std::string &out) { LINES100(1) }
+void part_2(std::string &out) { LINES100(2) }
+void part_3(std::string &out) { LINES100(3) }
+void part_4(std::string &out) { LINES100(4) }
+void part_5(std::string &out) { LINES100(5) }
+void part_6(std::string &out) { LINES100(6) }
+void part_7(std::string &out) { LINES100(7) }
+void part_8(std::string &out) { LINES100(8) }
+void part_9(std::string &out) { LINES100(9) }
+void part_10(std::string &out) { LINES100(10) }
+
+void long_patterns(std::string &out)
+{
+    LONG_LINE(1) LONG_LINE(2) LONG_LINE(3) LONG_LINE(4)
+    LONG_LINE(5) LONG_LINE(6) LONG_LINE(7) LONG_LINE(8)
+}
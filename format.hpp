@@ -1,22 +1,71 @@
 #ifndef __FORMAT_HPP__
 #define __FORMAT_HPP__
 
+#include <bit>
+#include <new>
+#include <list>
+#include <array>
+#include <cmath>
+#include <mutex>
 #include <tuple>
-#include <string>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
-#include <utility>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <utility>
+#include <charconv>
 #include <iterator>
+#include <algorithm>
+#include <exception>
 #include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
 
 #if __cplusplus <= 201703L
 #error only support in C++20
 #endif
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if __has_include(<sys/uio.h>)
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+#include <sys/uio.h>
+#define FMT_HAS_WRITEV
+#endif
+
 namespace fmt
 {
+struct hex_view;
+
+// specialize for a type to format it; the specialization is default constructed,
+// then `constexpr void parse(std::string_view spec)` (optional) receives the spec
+// after [[fill]align][width] and throws std::invalid_argument when it is invalid,
+// and `template<typename OutputIt> constexpr OutputIt format(const T &, OutputIt) const`
+// writes the value
+template<typename T, typename = void>
+struct formatter
+{
+    using builtin = void;
+};
+
 namespace details
 {
+template<typename T>
+inline constexpr bool has_formatter_v = !requires { typename formatter<T>::builtin; };
+
 template<typename T, typename = void>
 struct enable_begin_end : std::false_type {};
 template<typename T>
@@ -38,6 +87,23 @@ struct is_tuple<std::tuple<Args...>> : std::true_type {};
 template<typename T>
 inline constexpr bool is_tuple_v = is_tuple<T>::value;
 
+template<typename T, typename = void>
+struct is_map : std::false_type {};
+template<typename T>
+struct is_map<T, std::void_t<typename T::key_type, typename T::mapped_type>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_map_v = is_map<T>::value;
+
+// contiguous ranges of std::byte or unsigned char, which can be dumped as hex
+template<typename T, typename = void>
+struct is_byte_range : std::false_type {};
+template<typename T>
+struct is_byte_range<T, std::void_t<decltype(std::data(std::declval<T &>())), decltype(std::size(std::declval<T &>()))>>
+  : std::bool_constant<std::is_same_v<std::remove_cv_t<std::remove_pointer_t<decltype(std::data(std::declval<T &>()))>>, std::byte>
+                    || std::is_same_v<std::remove_cv_t<std::remove_pointer_t<decltype(std::data(std::declval<T &>()))>>, unsigned char>> {};
+template<typename T>
+inline constexpr bool is_byte_range_v = is_byte_range<T>::value;
+
 constexpr bool is_align(char chr)
 {
     return chr == '<' || chr == '^' || chr == '>';
@@ -55,7 +121,19 @@ constexpr bool is_digit(char chr)
 
 constexpr bool is_type(char chr)
 {
-    return chr == 'x' || chr == 'X' || chr == 'b' || chr == 'o';
+    return chr == 'x' || chr == 'X' || chr == 'b' || chr == 'o' || chr == 'e' || chr == 'E' || chr == '?' || chr == 'j';
+}
+
+// length of the UTF-8 sequence starting with lead, stray continuation bytes count as one
+constexpr std::size_t utf8_length(char lead)
+{
+    auto byte = static_cast<unsigned char>(lead);
+    return byte < 0xC0 ? 1 : byte < 0xE0 ? 2 : byte < 0xF0 ? 3 : 4;
+}
+
+constexpr bool is_continuation(char chr)
+{
+    return (static_cast<unsigned char>(chr) & 0xC0) == 0x80;
 }
 
 template<std::size_t N>
@@ -64,6 +142,8 @@ struct FixedString
     static constexpr std::size_t size = N - 1;
     char data[size] {};
 
+    constexpr FixedString() = default;
+
     constexpr FixedString(const char (&str)[N])
     {
         for (std::size_t i = 0; i < size; ++i)
@@ -77,28 +157,32 @@ struct FixedString
         return data[i];
     }
 
-    constexpr std::size_t find(char chr, std::size_t start = 0, std::size_t end = size) const
+    constexpr std::string_view view() const
     {
-        for (; start < end; ++start)
-        {
-            if (data[start] == chr)
-            {
-                return start;
-            }
-        }
-        return end;
+        return std::string_view(data, size);
     }
 
-    constexpr std::size_t find_consequent_digit(std::size_t start = 0, std::size_t end = size) const
+    constexpr operator std::string_view() const
     {
-        for (; start < end; ++start)
-        {
-            if (!is_digit(data[start]))
-            {
-                return start;
-            }
-        }
-        return end;
+        return view();
+    }
+};
+
+// the text of a format spec as written, kept for types with a formatter; the
+// capacity is that of the longest spec in the pattern, in steps of 32 so that
+// most patterns share one type, and 0 for runtime patterns, which keep only
+// its size
+template<std::size_t Capacity>
+struct SpecText
+{
+    std::array<char, Capacity> data {};
+    std::uint32_t size = 0;
+    // whether it is also a valid spec for the built-in types
+    bool is_valid = true;
+
+    constexpr std::string_view view() const
+    {
+        return std::string_view(data.data(), size);
     }
 };
 
@@ -118,7 +202,9 @@ struct Spec
     };
 
     std::uint8_t mode;
-    char         fill       = ' ';
+    // one UTF-8 encoded character, taking one column whatever its length
+    std::array<char, 4> fill = {' '};
+    std::uint8_t fill_size  = 1;
     char         align      = '<';
     char         sign       = 0;
     char         type       = 0;
@@ -133,13 +219,15 @@ struct Spec
 
     constexpr Spec(const Spec &other)
       : mode(other.mode)
-      , fill(other.fill), align(other.align)
+      , fill(other.fill), fill_size(other.fill_size), align(other.align)
       , sign(other.sign), type(other.type)
       , width(other.width), precision(other.precision)
     {
         // ...
     }
 
+    constexpr Spec &operator=(const Spec &other) = default;
+
     constexpr bool is_default() const
     {
         return mode == Default;
@@ -151,616 +239,3660 @@ struct Spec
     }
 };
 
-// declarations
-template<typename T1, typename T2>
-inline std::string pair_to_string(const std::pair<T1, T2> &pair);
-template<std::size_t index, typename ...Args>
-inline std::string tuple_to_string_impl(const std::tuple<Args...> &tuple);
-template<typename ...Args>
-inline std::string tuple_to_string(const std::tuple<Args...> &tuple);
-template<typename T>
-inline std::string container_to_string(T &&arg);
-template<Spec spec, typename T>
-inline std::string integer_to_string(T &&arg);
-template<Spec spec, typename T, typename ...Args>
-inline std::string float_to_string(T &&arg, const std::tuple<Args...> &args);
-template<Spec spec, typename T, typename ...Args>
-inline std::string numeral_to_string(T &&arg, const std::tuple<Args...> &args);
-template<Spec spec = Spec(), typename T, typename ...Args>
-inline std::string to_string(T &&arg, const std::tuple<Args...> &args);
+// output helpers
+template<typename Container>
+struct back_insert_accessor : std::back_insert_iterator<Container>
+{
+    using std::back_insert_iterator<Container>::container;
+};
+
+template<typename Container>
+constexpr Container &get_container(std::back_insert_iterator<Container> it)
+{
+    return *(it.*(&back_insert_accessor<Container>::container));
+}
+
+// back_insert_iterators into string-like containers are appended in bulk
+template<typename T, typename = void>
+struct is_appendable_iterator : std::false_type {};
+template<typename Container>
+struct is_appendable_iterator<std::back_insert_iterator<Container>, std::void_t<
+    decltype(std::declval<Container &>().append(std::declval<const char *>(), std::size_t())),
+    decltype(std::declval<Container &>().append(std::size_t(), char()))>> : std::true_type {};
 template<typename T>
-inline std::string to_string(T &&arg);
+inline constexpr bool is_appendable_iterator_v = is_appendable_iterator<T>::value;
 
-template<typename T1, typename T2>
-inline std::string pair_to_string(const std::pair<T1, T2> &pair)
+// output iterator which only counts the characters written through it
+struct counting_iterator
+{
+    using iterator_category = std::output_iterator_tag;
+    using value_type        = void;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = void;
+    using reference         = void;
+
+    struct proxy
+    {
+        constexpr void operator=(char) const {}
+    };
+
+    std::size_t count = 0;
+
+    constexpr proxy operator*() const
+    {
+        return proxy();
+    }
+
+    constexpr counting_iterator &operator++()
+    {
+        ++count;
+        return *this;
+    }
+
+    constexpr counting_iterator operator++(int)
+    {
+        auto it = *this;
+        ++count;
+        return it;
+    }
+};
+
+template<typename OutputIt>
+constexpr OutputIt write_char(OutputIt out, char chr)
 {
-    return '(' + to_string(pair.first) + ", " + to_string(pair.second) + ')';
+    *out++ = chr;
+    return out;
 }
 
-template<std::size_t index, typename ...Args>
-inline std::string tuple_to_string_impl(const std::tuple<Args...> &tuple)
+template<typename OutputIt>
+constexpr OutputIt write_str(OutputIt out, const char *str, std::size_t size)
 {
-    using Tuple = std::tuple<Args...>;
-    if constexpr (index == std::tuple_size_v<Tuple>)
+    if constexpr (std::is_same_v<OutputIt, counting_iterator>)
     {
-        return ")";
+        out.count += size;
+        return out;
     }
-    else if constexpr (index == 0)
+    else if constexpr (is_appendable_iterator_v<OutputIt>)
     {
-        return to_string(std::get<index>(tuple)) + tuple_to_string_impl<index + 1>(tuple);
+        get_container(out).append(str, size);
+        return out;
     }
     else
     {
-        return ", " + to_string(std::get<index>(tuple)) + tuple_to_string_impl<index + 1>(tuple);
+        return std::copy_n(str, size, out);
     }
 }
 
-template<typename ...Args>
-inline std::string tuple_to_string(const std::tuple<Args...> &tuple)
+template<typename OutputIt>
+constexpr OutputIt write_fill(OutputIt out, std::size_t count, char fill)
 {
-    using Tuple = std::tuple<Args...>;
-    if constexpr (std::tuple_size_v<Tuple> == 0)
+    if constexpr (std::is_same_v<OutputIt, counting_iterator>)
+    {
+        out.count += count;
+        return out;
+    }
+    else if constexpr (is_appendable_iterator_v<OutputIt>)
     {
-        return "()";
+        get_container(out).append(count, fill);
+        return out;
     }
     else
     {
-        return '(' + tuple_to_string_impl<0>(tuple);
+        return std::fill_n(out, count, fill);
     }
 }
 
-// for containers which enable begin() and end()
-template<typename T>
-inline std::string container_to_string(T &&arg)
+template<typename OutputIt>
+constexpr OutputIt write_fill(OutputIt out, std::size_t count, const Spec &spec)
 {
-    static_assert(enable_begin_end_v<std::decay_t<T>>, "Invalid argument");
-
-    std::string result = "{";
-    for (auto it = std::begin(arg); it != std::end(arg); ++it)
+    if (spec.fill_size == 1)
     {
-        if (it == std::begin(arg))
-        {
-            result += to_string(*it);
-        }
-        else
-        {
-            result += ", " + to_string(*it);
-        }
+        return write_fill(out, count, spec.fill[0]);
+    }
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        out = write_str(out, spec.fill.data(), spec.fill_size);
     }
-    return result + "}";
+    return out;
 }
 
-// for integers
-template<Spec spec, typename T>
-inline std::string integer_to_string(T &&arg)
+// pads whatever write emits, which must be size columns wide, to spec.width
+template<typename OutputIt, typename Writer>
+constexpr OutputIt write_padded(OutputIt out, const Spec &spec, std::size_t size, Writer &&write)
 {
-    static_assert(std::is_integral_v<std::decay_t<T>>, "Invalid argument");
-    static_assert(!spec.has_set(Spec::Precision), "Invalid argument");
+    if (size >= spec.width)
+    {
+        return write(out);
+    }
 
-    if constexpr (!spec.has_set(Spec::Type))
+    auto rest = spec.width - size;
+    switch (spec.align)
     {
-        return std::to_string(arg);
+    case '<':
+        return write_fill(write(out), rest, spec);
+    case '^':
+        out = write_fill(out, rest / 2, spec);
+        return write_fill(write(out), rest - rest / 2, spec);
+    default:
+        return write(write_fill(out, rest, spec));
     }
-    else
+}
+
+// true when no byte has the high bit set, 16 bytes at a time with SSE2
+constexpr bool is_ascii(const char *str, std::size_t size)
+{
+    std::size_t i = 0;
+    if (std::is_constant_evaluated())
     {
-        std::string result;
-        auto num = std::is_unsigned_v<std::decay_t<T>> ? arg : ((arg < 0) ? -arg : arg);
-        if constexpr (spec.type == 'x')
+        while (i < size && static_cast<unsigned char>(str[i]) < 0x80)
         {
-            do
-            {
-                auto rem = num & 0b1111;
-                if (rem < 10)
-                {
-                    result = static_cast<char>(rem + '0') + result;
-                }
-                else
-                {
-                    result = static_cast<char>(rem - 10 + 'a') + result;
-                }
-                num >>= 4;
-            } while (num != 0);
+            ++i;
         }
-        else if constexpr (spec.type == 'X')
+        return i == size;
+    }
+#if defined(__SSE2__)
+    for (; i + 16 <= size; i += 16)
+    {
+        if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i))) != 0)
         {
-            do
-            {
-                auto rem = num & 0b1111;
-                if (rem < 10)
-                {
-                    result = static_cast<char>(rem + '0') + result;
-                }
-                else
-                {
-                    result = static_cast<char>(rem - 10 + 'A') + result;
-                }
-                num >>= 4;
-            } while (num != 0);
+            return false;
         }
-        else if constexpr (spec.type == 'b')
+    }
+#endif
+    for (; i + 8 <= size; i += 8)
+    {
+        std::uint64_t word;
+        std::memcpy(&word, str + i, sizeof(word));
+        if (word & 0x8080808080808080u)
         {
-            do
-            {
-                result = static_cast<char>((num & 1) + '0') + result;
-                num >>= 1;
-            } while (num != 0);
+            return false;
         }
-        else
+    }
+    for (; i < size; ++i)
+    {
+        if (static_cast<unsigned char>(str[i]) >= 0x80)
         {
-            static_assert(spec.type == 'o', "Error! Please report!");
-
-            do
-            {
-                result = static_cast<char>((num & 0b111) + '0') + result;
-                num >>= 3;
-            } while (num != 0);
+            return false;
         }
-        return (arg < 0 ? "-0" : "0") + ((spec.type == 'X' ? 'x' : spec.type) + result);
     }
+    return true;
 }
 
-// for floats
-template<Spec spec, typename T, typename ...Args>
-inline std::string float_to_string(T &&arg, const std::tuple<Args...> &args)
+struct CodePointRange
 {
-    static_assert(std::is_floating_point_v<std::decay_t<T>>, "Invalid argument");
+    char32_t first;
+    char32_t last;
+};
+
+// combining marks, zero width spaces and joiners, variation selectors and emoji modifiers
+inline constexpr CodePointRange zero_width_ranges[] =
+{
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A}, {0x064B, 0x065F},
+    {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x1160, 0x11FF}, {0x1AB0, 0x1AFF},
+    {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x2028, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20FF},
+    {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0x1F3FB, 0x1F3FF}, {0xE0000, 0xE007F},
+    {0xE0100, 0xE01EF},
+};
 
-    if constexpr (!spec.has_set(Spec::Precision) && !spec.has_set(Spec::Type))
+// East Asian Wide and Fullwidth characters and emoji
+inline constexpr CodePointRange wide_ranges[] =
+{
+    {0x1100, 0x115F}, {0x2329, 0x232A}, {0x2E80, 0x303E}, {0x3040, 0xA4CF}, {0xAC00, 0xD7A3},
+    {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6},
+    {0x1F300, 0x1F64F}, {0x1F680, 0x1F6FF}, {0x1F900, 0x1F9FF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
+
+template<std::size_t N>
+constexpr bool in_ranges(const CodePointRange (&ranges)[N], char32_t cp)
+{
+    auto it = std::upper_bound(ranges, ranges + N, cp, [](char32_t cp, const CodePointRange &range)
     {
-        return std::to_string(arg);
-    }
-    else
+        return cp < range.first;
+    });
+    return it != ranges && cp <= (it - 1)->last;
+}
+
+constexpr std::size_t code_point_width(char32_t cp)
+{
+    return in_ranges(zero_width_ranges, cp) ? 0 : in_ranges(wide_ranges, cp) ? 2 : 1;
+}
+
+// terminal columns taken by UTF-8 text: wide characters take two, combining
+// marks none, and a ZWJ sequence is as wide as its first character; bytes
+// which are not valid UTF-8 take one each
+constexpr std::size_t display_width(std::string_view str)
+{
+    if (is_ascii(str.data(), str.size()))
     {
-        std::string fmtstr = "%";
+        return str.size();
+    }
 
-        if constexpr (spec.has_set(Spec::Precision))
+    std::size_t width = 0;
+    bool joined = false;
+    for (std::size_t i = 0; i < str.size();)
+    {
+        auto lead = static_cast<unsigned char>(str[i]);
+        std::size_t length = utf8_length(str[i]);
+        char32_t cp = lead;
+        if (lead >= 0xC0 && i + length <= str.size())
         {
-            std::size_t precision;
-            if constexpr (spec.has_set(Spec::PreciArg))
-            {
-                precision = std::get<spec.precision>(args);
-            }
-            else
+            cp = lead & (0x7F >> length);
+            for (std::size_t k = 1; k < length; ++k)
             {
-                precision = spec.precision;
+                if (!is_continuation(str[i + k]))
+                {
+                    cp = lead;
+                    length = 1;
+                    break;
+                }
+                cp = (cp << 6) | (str[i + k] & 0x3F);
             }
-            fmtstr += '.' + std::to_string(precision);
-        }
-
-        if constexpr (!spec.has_set(Spec::Type))
-        {
-            fmtstr += sizeof(T) == 4 ? "f" : "lf";
-        }
-        else if constexpr (spec.type == 'x')
-        {
-            fmtstr += sizeof(T) == 4 ? "a" : "la";
         }
         else
         {
-            static_assert(spec.type == 'X', "Error! Please report!");
-            fmtstr += sizeof(T) == 4 ? "A" : "lA";
+            length = 1;
         }
+        i += length;
 
-        std::string result(10, '\0');
-        int wrote = std::snprintf(result.data(), result.capacity(), fmtstr.c_str(), arg);
-        while (wrote < 0)
+        if (!joined)
         {
-            result.resize(result.capacity() * 2);
-            wrote = std::snprintf(result.data(), result.capacity(), fmtstr.c_str(), arg);
+            width += cp < 0x80 ? 1 : code_point_width(cp);
         }
-        result.resize(wrote);
-
-        return result;
+        joined = cp == 0x200D;
     }
+    return width;
 }
 
-// for numerals
-template<Spec spec, typename T, typename ...Args>
-inline std::string numeral_to_string(T &&arg, const std::tuple<Args...> &args)
+// declarations
+template<typename OutputIt, typename T1, typename T2>
+constexpr OutputIt write_pair(OutputIt out, const std::pair<T1, T2> &pair, const Spec &spec);
+template<std::size_t index, typename OutputIt, typename ...Args>
+constexpr OutputIt write_tuple_impl(OutputIt out, const std::tuple<Args...> &tuple, const Spec &spec);
+template<typename OutputIt, typename ...Args>
+constexpr OutputIt write_tuple(OutputIt out, const std::tuple<Args...> &tuple, const Spec &spec);
+template<typename OutputIt, typename T>
+constexpr OutputIt write_container(OutputIt out, T &&arg, const Spec &spec);
+template<typename OutputIt, typename View>
+inline OutputIt write_hex_view(OutputIt out, const View &view);
+template<typename OutputIt, typename T>
+constexpr OutputIt write_integer(OutputIt out, T arg, const Spec &spec);
+template<typename OutputIt, typename T>
+inline OutputIt write_float(OutputIt out, T arg, const Spec &spec);
+template<typename OutputIt, typename T>
+constexpr OutputIt write_numeral(OutputIt out, T &&arg, const Spec &spec);
+template<typename OutputIt, typename T>
+constexpr OutputIt write_value(OutputIt out, T &&arg, const Spec &spec);
+template<typename OutputIt, typename T>
+constexpr OutputIt write_value(OutputIt out, T &&arg);
+template<typename OutputIt, typename T>
+constexpr OutputIt write_arg(OutputIt out, T &&arg, const Spec &spec);
+
+// runs work(chunk, begin, end) over `chunks` consecutive slices of [0, size),
+// each on its own thread and the first on the calling one; the first exception
+// thrown by any chunk is rethrown once all of them are done
+template<typename Work>
+inline void parallel_chunks(std::size_t size, std::size_t chunks, Work &&work)
 {
-    std::string result;
-    if constexpr (std::is_integral_v<std::decay_t<T>>)
-    {
-        result = integer_to_string<spec>(arg);
-    }
-    else
+    std::vector<std::exception_ptr> errors(chunks);
+    auto run = [&](std::size_t chunk)
     {
-        result = float_to_string<spec>(arg, args);
-    }
-
-    std::size_t width;
-    if constexpr (spec.has_set(Spec::WidthArg))
-    {
-        width = std::get<spec.width>(args);
-    }
-    else if constexpr (spec.has_set(Spec::Width))
-    {
-        width = spec.width;
-    }
+        try
+        {
+            work(chunk, size * chunk / chunks, size * (chunk + 1) / chunks);
+        }
+        catch (...)
+        {
+            errors[chunk] = std::current_exception();
+        }
+    };
 
-    if constexpr (spec.has_set(Spec::Padding))
+    std::vector<std::thread> threads;
+    threads.reserve(chunks);
+    for (std::size_t chunk = 1; chunk < chunks; ++chunk)
     {
-        static_assert(spec.has_set(Spec::Width), "Error! Please report!");
-
-        auto sign = std::is_unsigned_v<std::decay_t<T>> ? '+' : ((arg < 0) ? '-' : '+');
-        bool has_sign = (spec.sign == '+' || arg < 0) ? true : false;
-
-        if (has_sign && sign == '+')
+        try
         {
-            result = '+' + result;
+            threads.emplace_back(run, chunk);
         }
-
-        if (result.size() < width)
+        catch (const std::system_error &)
         {
-            auto pos = spec.has_set(Spec::Type) ? (has_sign ? 3 : 2) : (has_sign ? 1 : 0);
-            result = result.substr(0, pos) + std::string(width - result.size(), '0') + result.substr(pos);
+            run(chunk);
         }
     }
-    else if constexpr (spec.sign == '+')
+    run(0);
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    for (auto &error : errors)
     {
-        if (arg >= 0)
+        if (error)
         {
-            result = '+' + result;
+            std::rethrow_exception(error);
         }
     }
-
-    return result;
 }
 
-template<Spec spec, typename T, typename ...Args>
-inline std::string to_string(T &&arg, const std::tuple<Args...> &args)
+// containers with at least parallel_threshold elements and random access are
+// split across parallel_threads threads (0 for all cores), see set_container_parallelism
+inline constexpr std::size_t container_threshold = 1 << 20;
+inline std::atomic<std::size_t> parallel_threshold {container_threshold};
+inline std::atomic<std::size_t> parallel_threads {0};
+
+// the spec of a pair, tuple or container applies to each of its elements
+template<typename OutputIt, typename T1, typename T2>
+constexpr OutputIt write_pair(OutputIt out, const std::pair<T1, T2> &pair, const Spec &spec)
 {
-    using RT = std::decay_t<T>;
+    out = write_char(out, '(');
+    out = write_arg(out, pair.first, spec);
+    out = write_str(out, ", ", 2);
+    out = write_arg(out, pair.second, spec);
+    return write_char(out, ')');
+}
 
-    if constexpr (std::is_convertible_v<RT, const char *> || std::is_convertible_v<RT, std::string>)
-    {
-        return arg;
-    }
-    else if constexpr (is_pair_v<RT>)
-    {
-        return pair_to_string(arg);
-    }
-    else if constexpr (is_tuple_v<RT>)
+template<std::size_t index, typename OutputIt, typename ...Args>
+constexpr OutputIt write_tuple_impl(OutputIt out, const std::tuple<Args...> &tuple, const Spec &spec)
+{
+    using Tuple = std::tuple<Args...>;
+    if constexpr (index == std::tuple_size_v<Tuple>)
     {
-        return tuple_to_string(arg);
+        return write_char(out, ')');
     }
-    else if constexpr (enable_begin_end_v<RT>)
+    else if constexpr (index == 0)
     {
-        return container_to_string(arg);
+        out = write_arg(out, std::get<index>(tuple), spec);
+        return write_tuple_impl<index + 1>(out, tuple, spec);
     }
     else
     {
-        return numeral_to_string<spec>(arg, args);
+        out = write_str(out, ", ", 2);
+        out = write_arg(out, std::get<index>(tuple), spec);
+        return write_tuple_impl<index + 1>(out, tuple, spec);
     }
 }
 
-template<typename T>
-inline std::string to_string(T &&arg)
-{
-    return to_string(arg, std::make_tuple());
-}
-
-template<Spec spec = Spec(), typename T, typename ...Args>
-inline std::string as_string(T &&arg, const std::tuple<Args...> &args)
+template<typename OutputIt, typename ...Args>
+constexpr OutputIt write_tuple(OutputIt out, const std::tuple<Args...> &tuple, const Spec &spec)
 {
-    if constexpr (spec.is_default())
-    {
-        return to_string(arg, args);
-    }
-
-    auto result = to_string<spec>(arg, args);
-
-    std::size_t width;
-    if constexpr (spec.has_set(Spec::WidthArg))
+    using Tuple = std::tuple<Args...>;
+    if constexpr (std::tuple_size_v<Tuple> == 0)
     {
-        width = std::get<spec.width>(args);
+        return write_str(out, "()", 2);
     }
-    else if constexpr (spec.has_set(Spec::Width))
+    else
     {
-        width = spec.width;
+        return write_tuple_impl<0>(write_char(out, '('), tuple, spec);
     }
+}
 
-    if constexpr (spec.has_set(Spec::Width))
+// one chunk of elements per thread, each formatted into its own buffer with
+// the separators of the serial loop; the buffers are then copied in at their
+// prefix offsets, in place and in parallel when the output is a string or buffer
+template<typename OutputIt, typename T>
+inline OutputIt write_container_parallel(OutputIt out, const T &arg, const Spec &spec, std::size_t size, std::size_t chunks)
+{
+    std::vector<std::string> buffers(chunks);
+    parallel_chunks(size, chunks, [&](std::size_t chunk, std::size_t begin, std::size_t end)
     {
-        if (result.size() < width)
+        auto it = std::begin(arg) + begin;
+        auto buffer = std::back_inserter(buffers[chunk]);
+        for (auto i = begin; i < end; ++i, ++it)
         {
-            if constexpr (spec.align == '<')
+            if (i != begin)
             {
-                result = result + std::string(width - result.size(), spec.fill);
+                buffer = write_str(buffer, ", ", 2);
             }
-            else if constexpr (spec.align == '^')
+            buffer = write_arg(buffer, *it, spec);
+        }
+    });
+
+    if constexpr (is_appendable_iterator_v<OutputIt> && requires (OutputIt it)
+                  { get_container(it).resize(0); get_container(it).data(); })
+    {
+        // "{" chunk ", " chunk ... "}"
+        std::vector<std::size_t> offsets(chunks + 1);
+        offsets[0] = 1;
+        for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            offsets[chunk + 1] = offsets[chunk] + buffers[chunk].size() + 2;
+        }
+        std::size_t total = offsets[chunks] - 1;
+
+        auto &container = get_container(out);
+        auto base = container.size();
+        container.resize(base + total);
+        char *dest = container.data() + base;
+        parallel_chunks(chunks, chunks, [&](std::size_t chunk, std::size_t, std::size_t)
+        {
+            if (chunk != 0)
             {
-                auto rest = width - result.size();
-                result = std::string(rest / 2, spec.fill) + result + std::string(rest - rest / 2, spec.fill);
+                std::memcpy(dest + offsets[chunk] - 2, ", ", 2);
             }
-            else
+            std::memcpy(dest + offsets[chunk], buffers[chunk].data(), buffers[chunk].size());
+        });
+        dest[0] = '{';
+        dest[total - 1] = '}';
+        return out;
+    }
+    else
+    {
+        out = write_char(out, '{');
+        for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            if (chunk != 0)
             {
-                static_assert(spec.align == '>', "Error! Please report!");
-                result = std::string(width - result.size(), spec.fill) + result;
+                out = write_str(out, ", ", 2);
             }
+            out = write_str(out, buffers[chunk].data(), buffers[chunk].size());
         }
+        return write_char(out, '}');
     }
-
-    return result;
 }
 
-template<FixedString pattern>
-constexpr std::size_t as_size_t(std::size_t begin, std::size_t end)
+// for containers which enable begin() and end(), maps are written as {key: value, ...}
+template<typename OutputIt, typename T>
+constexpr OutputIt write_container(OutputIt out, T &&arg, const Spec &spec)
 {
-    std::size_t res = 0;
-    for (; begin < end; ++begin)
+    static_assert(enable_begin_end_v<std::decay_t<T>>, "Invalid argument");
+
+    if constexpr (std::random_access_iterator<decltype(std::begin(arg))> && !is_map_v<std::decay_t<T>>
+                  && !std::is_same_v<OutputIt, counting_iterator>)
     {
-        if (!is_digit(pattern[begin]))
+        std::size_t size = std::end(arg) - std::begin(arg);
+        if (!std::is_constant_evaluated() && size >= parallel_threshold.load(std::memory_order_relaxed))
         {
-            throw std::invalid_argument("Invalid integer");
+            std::size_t threads = parallel_threads.load(std::memory_order_relaxed);
+            threads = std::min<std::size_t>(threads ? threads : std::thread::hardware_concurrency(), size);
+            if (threads > 1)
+            {
+                return write_container_parallel(out, arg, spec, size, threads);
+            }
         }
-        res = res * 10 + pattern[begin] - '0';
     }
-    return res;
-}
-
-template<FixedString pattern, std::size_t begin, std::size_t end, Spec::Mode anchor = Spec::Default>
-constexpr Spec as_spec()
-{
-    static_assert(begin <= end, "Error! Please report!");
 
-    if constexpr (begin == end)
+    out = write_char(out, '{');
+    for (auto it = std::begin(arg); it != std::end(arg); ++it)
     {
-        return Spec();
+        if (it != std::begin(arg))
+        {
+            out = write_str(out, ", ", 2);
+        }
+        if constexpr (is_map_v<std::decay_t<T>>)
+        {
+            out = write_arg(out, it->first, spec);
+            out = write_str(out, ": ", 2);
+            out = write_arg(out, it->second, spec);
+        }
+        else
+        {
+            out = write_arg(out, *it, spec);
+        }
     }
-    else if constexpr (begin + 1 < end && is_align(pattern[begin + 1]))
-    {
-        static_assert(anchor < Spec::Align, "Invalid format spec");
+    return write_char(out, '}');
+}
 
-        constexpr auto rspec = as_spec<pattern, begin + 2, end, Spec::Align>();
-        static_assert(rspec.has_set(Spec::Width), "Invalid format spec");
-        static_assert(!rspec.has_set(Spec::Padding), "Invalid format spec");
+// lookup tables for the integer kernels, two characters per entry except bin4
+inline constexpr char digits2[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
 
-        auto spec = rspec;
-        spec.mode |= Spec::Align;
-        spec.fill = pattern[begin];
-        spec.align = pattern[begin + 1];
-        return spec;
-    }
-    else if constexpr (is_align(pattern[begin]))
+inline constexpr auto make_radix_table = [](unsigned bits, unsigned chars, bool upper)
+{
+    std::array<char, 1024> table {};
+    const char *nibbles = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    for (unsigned value = 0; value < (1u << (bits * chars)); ++value)
     {
-        static_assert(anchor < Spec::Align, "Invalid format spec");
+        for (unsigned i = 0; i < chars; ++i)
+        {
+            table[value * chars + i] = nibbles[(value >> (bits * (chars - 1 - i))) & ((1u << bits) - 1)];
+        }
+    }
+    return table;
+};
+
+inline constexpr auto hex2_lower = make_radix_table(4, 2, false);
+inline constexpr auto hex2_upper = make_radix_table(4, 2, true);
+inline constexpr auto oct2 = make_radix_table(3, 2, false);
+inline constexpr auto bin4 = make_radix_table(1, 4, false);
+
+// 0 instead of 1 in the first slot makes count_digits(0) == 1
+inline constexpr std::uint64_t zero_or_powers_of_10[] =
+{
+    0, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+    100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+    10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+    100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull,
+};
+
+template<std::size_t N>
+constexpr void copy_chars(char *dest, const char *src)
+{
+    for (std::size_t i = 0; i < N; ++i)
+    {
+        dest[i] = src[i];
+    }
+}
+
+template<typename UInt>
+constexpr std::size_t count_digits(UInt value, char type)
+{
+    std::size_t bits = std::bit_width(value | 1);
+    switch (type)
+    {
+    case 'x': case 'X':
+        return (bits + 3) / 4;
+    case 'b':
+        return bits;
+    case 'o':
+        return (bits + 2) / 3;
+    default:
+        // bits * log10(2) estimates the digit count, the table corrects it by one
+        auto digits = bits * 1233 >> 12;
+        return digits + 1 - (value < zero_or_powers_of_10[digits]);
+    }
+}
+
+// writes exactly `digits` digits of value ending at end, returns the first one
+template<typename UInt>
+constexpr char *format_digits(char *end, UInt value, std::size_t digits, char type)
+{
+    if (type == 'x' || type == 'X')
+    {
+        const char *table = (type == 'x' ? hex2_lower : hex2_upper).data();
+        for (; digits >= 2; digits -= 2, value >>= 8)
+        {
+            copy_chars<2>(end -= 2, table + (value & 0xff) * 2);
+        }
+        if (digits != 0)
+        {
+            *--end = table[(value & 0xf) * 2 + 1];
+        }
+    }
+    else if (type == 'b')
+    {
+        for (; digits >= 4; digits -= 4, value >>= 4)
+        {
+            copy_chars<4>(end -= 4, bin4.data() + (value & 0xf) * 4);
+        }
+        for (; digits != 0; --digits, value >>= 1)
+        {
+            *--end = static_cast<char>('0' + (value & 1));
+        }
+    }
+    else if (type == 'o')
+    {
+        for (; digits >= 2; digits -= 2, value >>= 6)
+        {
+            copy_chars<2>(end -= 2, oct2.data() + (value & 077) * 2);
+        }
+        if (digits != 0)
+        {
+            *--end = static_cast<char>('0' + (value & 07));
+        }
+    }
+    else
+    {
+        for (; value >= 100; value /= 100)
+        {
+            copy_chars<2>(end -= 2, digits2 + (value % 100) * 2);
+        }
+        if (value < 10)
+        {
+            *--end = static_cast<char>('0' + value);
+        }
+        else
+        {
+            copy_chars<2>(end -= 2, digits2 + value * 2);
+        }
+    }
+    return end;
+}
+
+template<typename T>
+using integer_kernel_t = std::conditional_t<(sizeof(T) <= sizeof(std::uint32_t)), std::uint32_t, std::uint64_t>;
+
+// magnitude of arg, computed in unsigned arithmetic so the minimum value is safe
+template<typename T>
+constexpr integer_kernel_t<T> integer_magnitude(T arg)
+{
+    using UInt = integer_kernel_t<T>;
+    if constexpr (std::is_signed_v<T>)
+    {
+        return arg < 0 ? UInt(0) - static_cast<UInt>(arg) : static_cast<UInt>(arg);
+    }
+    else
+    {
+        return static_cast<UInt>(arg);
+    }
+}
+
+template<typename T>
+constexpr bool is_negative(T arg)
+{
+    if constexpr (std::is_signed_v<T>)
+    {
+        return arg < 0;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+// size of sign, prefix and digits, i.e. everything but zero padding
+template<typename T>
+constexpr std::size_t integer_size(T arg, const Spec &spec)
+{
+    static_assert(sizeof(T) <= sizeof(std::uint64_t), "Invalid argument");
+
+    bool has_sign = is_negative(arg) || spec.sign == '+';
+    return (has_sign ? 1 : 0) + (spec.has_set(Spec::Type) ? 2 : 0) + count_digits(integer_magnitude(arg), spec.type);
+}
+
+// for integers
+template<typename OutputIt, typename T>
+constexpr OutputIt write_integer(OutputIt out, T arg, const Spec &spec)
+{
+    static_assert(std::is_integral_v<T>, "Invalid argument");
+    static_assert(sizeof(T) <= sizeof(std::uint64_t), "Invalid argument");
+
+    auto value = integer_magnitude(arg);
+    auto digits = count_digits(value, spec.type);
+
+    // sign + "0b" + 64 binary digits
+    char buffer[68];
+    char *end = buffer + sizeof(buffer);
+    char *begin = format_digits(end, value, digits, spec.type);
+    if (spec.has_set(Spec::Type))
+    {
+        *--begin = spec.type == 'X' ? 'x' : spec.type;
+        *--begin = '0';
+    }
+    if (is_negative(arg))
+    {
+        *--begin = '-';
+    }
+    else if (spec.sign == '+')
+    {
+        *--begin = '+';
+    }
+
+    std::size_t size = end - begin;
+    if (spec.has_set(Spec::Padding) && size < spec.width)
+    {
+        // zeros go between the sign/prefix and the digits
+        std::size_t prefix = size - digits;
+        out = write_str(out, begin, prefix);
+        out = write_fill(out, spec.width - size, '0');
+        return write_str(out, begin + prefix, digits);
+    }
+    return write_str(out, begin, size);
+}
+
+// hex dumps of byte buffers, two characters per byte; the SIMD kernels
+// split each byte into nibbles and look both up with a single shuffle
+using hex_encoder = void (*)(char *out, const unsigned char *bytes, std::size_t size, bool upper);
+
+inline void hex_encode_scalar(char *out, const unsigned char *bytes, std::size_t size, bool upper)
+{
+    const char *table = upper ? hex2_upper.data() : hex2_lower.data();
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        copy_chars<2>(out + 2 * i, table + 2 * bytes[i]);
+    }
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+__attribute__((target("ssse3")))
+inline void hex_encode_ssse3(char *out, const unsigned char *bytes, std::size_t size, bool upper)
+{
+    const __m128i table = _mm_loadu_si128(reinterpret_cast<const __m128i *>(upper ? "0123456789ABCDEF" : "0123456789abcdef"));
+    const __m128i mask = _mm_set1_epi8(0x0F);
+
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i));
+        __m128i high = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(value, 4), mask));
+        __m128i low = _mm_shuffle_epi8(table, _mm_and_si128(value, mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i), _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i + 16), _mm_unpackhi_epi8(high, low));
+    }
+    hex_encode_scalar(out + 2 * i, bytes + i, size - i, upper);
+}
+
+__attribute__((target("avx2")))
+inline void hex_encode_avx2(char *out, const unsigned char *bytes, std::size_t size, bool upper)
+{
+    const __m256i table = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(upper ? "0123456789ABCDEF" : "0123456789abcdef")));
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i));
+        __m256i high = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(value, 4), mask));
+        __m256i low = _mm256_shuffle_epi8(table, _mm256_and_si256(value, mask));
+        // unpacking works within 128-bit lanes, so the halves are swapped back in order
+        __m256i first = _mm256_unpacklo_epi8(high, low);
+        __m256i second = _mm256_unpackhi_epi8(high, low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2 * i), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2 * i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    hex_encode_ssse3(out + 2 * i, bytes + i, size - i, upper);
+}
+#endif
+
+// picks the widest kernel the CPU supports, once
+inline hex_encoder select_hex_encoder()
+{
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return hex_encode_avx2;
+    }
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        return hex_encode_ssse3;
+    }
+#endif
+    return hex_encode_scalar;
+}
+
+inline void hex_encode(char *out, const unsigned char *bytes, std::size_t size, bool upper)
+{
+    static const hex_encoder encoder = select_hex_encoder();
+    encoder(out, bytes, size, upper);
+}
+
+// encodes in place at the end of strings and buffers, and through a stack
+// buffer for any other output iterator
+template<typename OutputIt>
+inline OutputIt write_hex(OutputIt out, const unsigned char *bytes, std::size_t size, bool upper)
+{
+    if constexpr (std::is_same_v<OutputIt, counting_iterator>)
+    {
+        out.count += 2 * size;
+        return out;
+    }
+    else if constexpr (is_appendable_iterator_v<OutputIt> && requires (OutputIt it)
+                       { get_container(it).resize(0); get_container(it).data(); })
+    {
+        auto &container = get_container(out);
+        auto offset = container.size();
+        container.resize(offset + 2 * size);
+        hex_encode(container.data() + offset, bytes, size, upper);
+        return out;
+    }
+    else
+    {
+        char buffer[1024];
+        while (size > 0)
+        {
+            auto chunk = std::min(size, sizeof(buffer) / 2);
+            hex_encode(buffer, bytes, chunk, upper);
+            out = write_str(out, buffer, 2 * chunk);
+            bytes += chunk;
+            size -= chunk;
+        }
+        return out;
+    }
+}
+
+// {} and {:x} of a std::byte range, {:x} of an unsigned char range
+template<typename OutputIt, typename T>
+inline OutputIt write_byte_range(OutputIt out, const T &range, const Spec &spec)
+{
+    auto bytes = reinterpret_cast<const unsigned char *>(std::data(range));
+    std::size_t size = std::size(range);
+    return write_padded(out, spec, 2 * size, [&](OutputIt out)
+    {
+        return write_hex(out, bytes, size, spec.type == 'X');
+    });
+}
+
+// shortest round-trip digits for {}, fixed for {:.N}, scientific for e/E and hex for x/X
+template<typename T>
+inline std::to_chars_result float_to_chars(char *first, char *last, T arg, const Spec &spec)
+{
+    if (!spec.has_set(Spec::Type) && !spec.has_set(Spec::Precision))
+    {
+        return std::to_chars(first, last, arg);
+    }
+
+    auto format = !spec.has_set(Spec::Type) ? std::chars_format::fixed
+                : (spec.type == 'e' || spec.type == 'E') ? std::chars_format::scientific
+                : std::chars_format::hex;
+    if (spec.has_set(Spec::Precision))
+    {
+        return std::to_chars(first, last, arg, format, static_cast<int>(spec.precision));
+    }
+    return std::to_chars(first, last, arg, format);
+}
+
+// for floats
+template<typename OutputIt, typename T>
+inline OutputIt write_float(OutputIt out, T arg, const Spec &spec)
+{
+    static_assert(std::is_floating_point_v<T>, "Invalid argument");
+
+    bool is_hex = spec.type == 'x' || spec.type == 'X';
+    bool is_upper = spec.type == 'X' || spec.type == 'E';
+
+    // room for sign and "0x" ahead of the digits
+    constexpr std::size_t reserved = 3;
+    char buffer[128];
+    std::string heap;
+
+    bool is_negative = std::signbit(arg);
+    char *first = buffer + reserved;
+    auto result = float_to_chars(first, std::end(buffer), std::abs(arg), spec);
+    if (result.ec != std::errc())
+    {
+        // only long fixed or high precision output gets here
+        heap.resize(reserved + std::numeric_limits<T>::max_exponent10 + spec.precision + 16);
+        first = heap.data() + reserved;
+        result = float_to_chars(first, heap.data() + heap.size(), std::abs(arg), spec);
+    }
+
+    char *begin = first;
+    if (is_upper)
+    {
+        std::transform(first, result.ptr, first, [](char chr)
+        {
+            return ('a' <= chr && chr <= 'z') ? static_cast<char>(chr - 'a' + 'A') : chr;
+        });
+    }
+    if (is_hex && std::isfinite(arg))
+    {
+        *--begin = is_upper ? 'X' : 'x';
+        *--begin = '0';
+    }
+    if (is_negative)
+    {
+        *--begin = '-';
+    }
+    else if (spec.sign == '+')
+    {
+        *--begin = '+';
+    }
+
+    std::size_t size = result.ptr - begin;
+    if (spec.has_set(Spec::Padding))
+    {
+        if (size < spec.width)
+        {
+            // zeros go between the sign/prefix and the digits
+            std::size_t prefix = first - begin;
+            out = write_str(out, begin, prefix);
+            out = write_fill(out, spec.width - size, '0');
+            return write_str(out, first, result.ptr - first);
+        }
+        return write_str(out, begin, size);
+    }
+
+    // aligned here rather than in write_arg so the value is converted once
+    return write_padded(out, spec, size, [&](OutputIt out)
+    {
+        return write_str(out, begin, size);
+    });
+}
+
+// for numerals
+template<typename OutputIt, typename T>
+constexpr OutputIt write_numeral(OutputIt out, T &&arg, const Spec &spec)
+{
+    if constexpr (std::is_integral_v<std::decay_t<T>>)
+    {
+        return write_integer(out, static_cast<std::decay_t<T>>(arg), spec);
+    }
+    else
+    {
+        return write_float(out, static_cast<std::decay_t<T>>(arg), spec);
+    }
+}
+
+// const arrays are taken to be string literals, ending in their only NUL;
+// a mutable buffer may hold a shorter string, or fill all of its bytes
+template<typename T>
+inline constexpr bool is_literal_v = std::is_array_v<std::remove_reference_t<T>> && std::is_const_v<std::remove_reference_t<T>>;
+
+// a string literal carries its length in its type, strlen is only needed
+// for arrays holding a shorter string
+template<typename T>
+constexpr std::string_view as_string_view(const T &arg)
+{
+    using RT = std::remove_cvref_t<T>;
+
+    if constexpr (std::is_array_v<RT>)
+    {
+        constexpr std::size_t N = std::extent_v<RT>;
+        if (N > 0 && arg[N - 1] == '\0' && (N == 1 || arg[N - 2] != '\0'))
+        {
+            return std::string_view(arg, N - 1);
+        }
+        return std::string_view(arg, std::find(arg, arg + N, '\0') - arg);
+    }
+    else
+    {
+        return arg;
+    }
+}
+
+// escaped strings, for '?' as a debug string and for 'j' as a JSON one; the
+// SIMD kernels find the next quote, backslash or control character 16 or 32
+// bytes at a time so that the clean runs in between are copied in bulk
+using escape_finder = std::size_t (*)(const char *str, std::size_t size, bool debug);
+
+constexpr bool is_escaped(char chr, bool debug)
+{
+    auto byte = static_cast<unsigned char>(chr);
+    return byte < 0x20 || chr == '"' || chr == '\\' || (debug && byte == 0x7F);
+}
+
+constexpr std::size_t find_escape_scalar(const char *str, std::size_t size, bool debug)
+{
+    std::size_t i = 0;
+    while (i < size && !is_escaped(str[i], debug))
+    {
+        ++i;
+    }
+    return i;
+}
+
+#if defined(__SSE2__)
+inline std::size_t find_escape_sse2(const char *str, std::size_t size, bool debug)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    const __m128i del = _mm_set1_epi8(debug ? 0x7F : '"');
+
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i));
+        // max(value, 0x1F) == 0x1F exactly for the bytes up to 0x1F
+        __m128i found = _mm_or_si128(_mm_cmpeq_epi8(value, quote), _mm_cmpeq_epi8(value, backslash));
+        found = _mm_or_si128(found, _mm_cmpeq_epi8(_mm_max_epu8(value, control), control));
+        found = _mm_or_si128(found, _mm_cmpeq_epi8(value, del));
+        if (int mask = _mm_movemask_epi8(found))
+        {
+            return i + std::countr_zero(static_cast<unsigned>(mask));
+        }
+    }
+    return i + find_escape_scalar(str + i, size - i, debug);
+}
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+__attribute__((target("avx2")))
+inline std::size_t find_escape_avx2(const char *str, std::size_t size, bool debug)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    const __m256i del = _mm256_set1_epi8(debug ? 0x7F : '"');
+
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(str + i));
+        __m256i found = _mm256_or_si256(_mm256_cmpeq_epi8(value, quote), _mm256_cmpeq_epi8(value, backslash));
+        found = _mm256_or_si256(found, _mm256_cmpeq_epi8(_mm256_max_epu8(value, control), control));
+        found = _mm256_or_si256(found, _mm256_cmpeq_epi8(value, del));
+        if (unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(found)))
+        {
+            return i + std::countr_zero(mask);
+        }
+    }
+#if defined(__SSE2__)
+    return i + find_escape_sse2(str + i, size - i, debug);
+#else
+    return i + find_escape_scalar(str + i, size - i, debug);
+#endif
+}
+#endif
+
+inline escape_finder select_escape_finder()
+{
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return find_escape_avx2;
+    }
+#endif
+#if defined(__SSE2__)
+    return find_escape_sse2;
+#else
+    return find_escape_scalar;
+#endif
+}
+
+// the length of the clean run at the start of str
+inline std::size_t find_escape(const char *str, std::size_t size, bool debug)
+{
+    static const escape_finder finder = select_escape_finder();
+    return finder(str, size, debug);
+}
+
+template<typename OutputIt>
+constexpr OutputIt write_escape(OutputIt out, char chr, bool debug)
+{
+    constexpr const char *digits = "0123456789abcdef";
+    auto byte = static_cast<unsigned char>(chr);
+    switch (chr)
+    {
+    case '"':
+        return write_str(out, "\\\"", 2);
+    case '\\':
+        return write_str(out, "\\\\", 2);
+    case '\n':
+        return write_str(out, "\\n", 2);
+    case '\r':
+        return write_str(out, "\\r", 2);
+    case '\t':
+        return write_str(out, "\\t", 2);
+    }
+    if (debug)
+    {
+        // \u{1b} as in std::format, with as few digits as needed
+        out = write_str(out, "\\u{", 3);
+        if (byte >= 0x10)
+        {
+            out = write_char(out, digits[byte >> 4]);
+        }
+        out = write_char(out, digits[byte & 0xF]);
+        return write_char(out, '}');
+    }
+    switch (chr)
+    {
+    case '\b':
+        return write_str(out, "\\b", 2);
+    case '\f':
+        return write_str(out, "\\f", 2);
+    }
+    out = write_str(out, "\\u00", 4);
+    out = write_char(out, digits[byte >> 4]);
+    return write_char(out, digits[byte & 0xF]);
+}
+
+// str in double quotes with everything that needs it escaped; other bytes,
+// UTF-8 included, are copied as they are
+template<typename OutputIt>
+constexpr OutputIt write_escaped(OutputIt out, std::string_view str, bool debug)
+{
+    out = write_char(out, '"');
+    std::size_t pos = 0;
+    while (pos < str.size())
+    {
+        auto clean = std::is_constant_evaluated() ? find_escape_scalar(str.data() + pos, str.size() - pos, debug)
+                                                  : find_escape(str.data() + pos, str.size() - pos, debug);
+        out = write_str(out, str.data() + pos, clean);
+        pos += clean;
+        if (pos < str.size())
+        {
+            out = write_escape(out, str[pos++], debug);
+        }
+    }
+    return write_char(out, '"');
+}
+
+template<typename OutputIt>
+constexpr OutputIt write_string(OutputIt out, std::string_view str, const Spec &spec)
+{
+    if (spec.type == '?' || spec.type == 'j')
+    {
+        return write_escaped(out, str, spec.type == '?');
+    }
+    return write_str(out, str.data(), str.size());
+}
+
+template<typename OutputIt, typename T>
+constexpr OutputIt write_value(OutputIt out, T &&arg, const Spec &spec)
+{
+    using RT = std::decay_t<T>;
+
+    if constexpr (has_formatter_v<RT>)
+    {
+        return formatter<RT>().format(arg, out);
+    }
+    else if constexpr (std::is_convertible_v<RT, std::string_view>)
+    {
+        return write_string(out, as_string_view(arg), spec);
+    }
+    else if constexpr (std::is_convertible_v<RT, std::string>)
+    {
+        std::string str = arg;
+        return write_string(out, str, spec);
+    }
+    else if constexpr (std::is_same_v<RT, hex_view>)
+    {
+        if (spec.type == 'X' && !arg.options.upper)
+        {
+            auto upper = arg;
+            upper.options.upper = true;
+            return write_hex_view(out, upper);
+        }
+        return write_hex_view(out, arg);
+    }
+    else if constexpr (is_byte_range_v<RT>)
+    {
+        if constexpr (std::is_same_v<std::remove_cvref_t<decltype(*std::data(arg))>, std::byte>)
+        {
+            return write_byte_range(out, arg, spec);
+        }
+        else
+        {
+            if (spec.type == 'x' || spec.type == 'X')
+            {
+                return write_byte_range(out, arg, spec);
+            }
+            return write_container(out, arg, spec);
+        }
+    }
+    else if constexpr (is_pair_v<RT>)
+    {
+        return write_pair(out, arg, spec);
+    }
+    else if constexpr (is_tuple_v<RT>)
+    {
+        return write_tuple(out, arg, spec);
+    }
+    else if constexpr (enable_begin_end_v<RT>)
+    {
+        return write_container(out, arg, spec);
+    }
+    else
+    {
+        return write_numeral(out, arg, spec);
+    }
+}
+
+template<typename OutputIt, typename T>
+constexpr OutputIt write_value(OutputIt out, T &&arg)
+{
+    return write_value(out, arg, Spec());
+}
+
+// a type with a formatter writes straight into out, and when it has to be
+// padded it is measured by formatting it into a counting_iterator first
+template<typename OutputIt, typename T, typename Formatter>
+constexpr OutputIt write_formatted(OutputIt out, const T &arg, const Spec &spec, const Formatter &formatter)
+{
+    if (!spec.has_set(Spec::Width))
+    {
+        return formatter.format(arg, out);
+    }
+
+    auto size = formatter.format(arg, counting_iterator()).count;
+    return write_padded(out, spec, size, [&](OutputIt out)
+    {
+        return formatter.format(arg, out);
+    });
+}
+
+// spec must already hold the widths and precisions taken from arguments
+template<typename OutputIt, typename T>
+constexpr OutputIt write_arg(OutputIt out, T &&arg, const Spec &spec)
+{
+    using RT = std::decay_t<T>;
+
+    if constexpr (has_formatter_v<RT>)
+    {
+        return write_formatted(out, arg, spec, formatter<RT>());
+    }
+    // floats align themselves and composites pass the spec on to their elements
+    else if constexpr (std::is_floating_point_v<RT> || (!std::is_convertible_v<RT, std::string_view>
+                  && (is_pair_v<RT> || is_tuple_v<RT> || enable_begin_end_v<RT>)))
+    {
+        return write_value(out, arg, spec);
+    }
+    else
+    {
+        if (!spec.has_set(Spec::Width))
+        {
+            return write_value(out, arg, spec);
+        }
+
+        // measure first so that the fill can be emitted ahead of the value
+        std::size_t size;
+        if constexpr (std::is_convertible_v<RT, std::string_view>)
+        {
+            auto str = as_string_view(arg);
+            size = display_width(str);
+            if (spec.type == '?' || spec.type == 'j')
+            {
+                // escapes and quotes are ASCII, one column per byte
+                size += write_escaped(counting_iterator(), str, spec.type == '?').count - str.size();
+            }
+        }
+        else if constexpr (std::is_integral_v<RT>)
+        {
+            size = integer_size(static_cast<RT>(arg), spec);
+            if (spec.has_set(Spec::Padding))
+            {
+                size = std::max(size, spec.width);
+            }
+        }
+        else
+        {
+            size = write_value(counting_iterator(), arg, spec).count;
+        }
+
+        return write_padded(out, spec, size, [&](OutputIt out)
+        {
+            return write_value(out, arg, spec);
+        });
+    }
+}
+
+// rejects specs which make no sense for T, at compile time when called in a constant expression
+template<typename T>
+constexpr bool check_spec(const Spec &spec)
+{
+    if constexpr (has_formatter_v<T> || std::is_convertible_v<T, std::string_view> || std::is_convertible_v<T, std::string>)
+    {
+        return true;
+    }
+    else if constexpr (is_pair_v<T>)
+    {
+        return check_spec<std::decay_t<typename T::first_type>>(spec) && check_spec<std::decay_t<typename T::second_type>>(spec);
+    }
+    else if constexpr (is_tuple_v<T>)
+    {
+        return [&]<typename ...Elems>(std::tuple<Elems...> *)
+        {
+            return (check_spec<std::decay_t<Elems>>(spec) && ...);
+        }(static_cast<T *>(nullptr));
+    }
+    else if constexpr (std::is_same_v<T, hex_view>)
+    {
+        // already a dump, so only its case and layout may be given
+        if ((spec.has_set(Spec::Type) && spec.type != 'x' && spec.type != 'X')
+            || spec.has_set(Spec::Sign) || spec.has_set(Spec::Padding) || spec.has_set(Spec::Precision))
+        {
+            throw std::invalid_argument("Invalid format spec");
+        }
+        return true;
+    }
+    else if constexpr (is_byte_range_v<T>)
+    {
+        using Elem = std::remove_cvref_t<decltype(*std::data(std::declval<T &>()))>;
+        bool is_dump = spec.type == 'x' || spec.type == 'X';
+        if (std::is_same_v<Elem, std::byte> && spec.has_set(Spec::Type) && !is_dump)
+        {
+            throw std::invalid_argument("Invalid format spec");
+        }
+        if (is_dump || std::is_same_v<Elem, std::byte>)
+        {
+            if (spec.has_set(Spec::Sign) || spec.has_set(Spec::Padding) || spec.has_set(Spec::Precision))
+            {
+                throw std::invalid_argument("Invalid format spec");
+            }
+            return true;
+        }
+        return check_spec<Elem>(spec);
+    }
+    else if constexpr (enable_begin_end_v<T>)
+    {
+        return check_spec<std::decay_t<decltype(*std::begin(std::declval<T &>()))>>(spec);
+    }
+    else if constexpr (std::is_integral_v<T>)
+    {
+        if (spec.has_set(Spec::Precision) || spec.type == 'e' || spec.type == 'E' || spec.type == '?' || spec.type == 'j')
+        {
+            throw std::invalid_argument("Invalid format spec");
+        }
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        if (spec.type == 'b' || spec.type == 'o' || spec.type == '?' || spec.type == 'j')
+        {
+            throw std::invalid_argument("Invalid format spec");
+        }
+    }
+    return true;
+}
+
+// width and precision taken from arguments are looked up here, once per placeholder
+template<Spec spec, typename T, typename ...Args>
+constexpr Spec resolve_spec(const std::tuple<Args...> &args)
+{
+    static_assert(check_spec<std::decay_t<T>>(spec), "Invalid format spec");
+
+    Spec resolved = spec;
+    if constexpr (spec.has_set(Spec::WidthArg))
+    {
+        static_assert(spec.width < sizeof...(Args), "Positional parameters not match");
+        resolved.width = std::get<spec.width>(args);
+    }
+    if constexpr (spec.has_set(Spec::PreciArg))
+    {
+        static_assert(spec.precision < sizeof...(Args), "Positional parameters not match");
+        resolved.precision = std::get<spec.precision>(args);
+    }
+    return resolved;
+}
+
+constexpr std::size_t as_size_t(std::string_view str)
+{
+    std::size_t res = 0;
+    for (auto chr : str)
+    {
+        if (!is_digit(chr))
+        {
+            throw std::invalid_argument("Invalid integer");
+        }
+        res = res * 10 + chr - '0';
+    }
+    return res;
+}
+
+// reads count := integer | integer '$' at pos into value, setting mode or arg_mode
+constexpr void parse_count(std::string_view str, std::size_t &pos, std::size_t &value,
+                           Spec &spec, Spec::Mode mode, Spec::Mode arg_mode)
+{
+    auto begin = pos;
+    while (pos < str.size() && is_digit(str[pos]))
+    {
+        ++pos;
+    }
+    value = as_size_t(str.substr(begin, pos - begin));
+    if (pos < str.size() && str[pos] == '$')
+    {
+        spec.mode |= arg_mode;
+        ++pos;
+    }
+    else
+    {
+        spec.mode |= mode;
+    }
+}
+
+// [[fill]align], returns how many characters it takes
+constexpr std::size_t parse_align(std::string_view str, Spec &spec)
+{
+    // the fill is a single character, which may take several bytes in UTF-8
+    std::size_t fill_size = str.empty() ? 1 : utf8_length(str[0]);
+    bool is_fill = str.size() > fill_size && is_align(str[fill_size]);
+    for (std::size_t i = 1; is_fill && i < fill_size; ++i)
+    {
+        is_fill = is_continuation(str[i]);
+    }
+
+    if (is_fill)
+    {
+        spec.mode |= Spec::Align;
+        for (std::size_t i = 0; i < fill_size; ++i)
+        {
+            spec.fill[i] = str[i];
+        }
+        spec.fill_size = static_cast<std::uint8_t>(fill_size);
+        spec.align = str[fill_size];
+        return fill_size + 1;
+    }
+    if (!str.empty() && is_align(str[0]))
+    {
+        spec.mode |= Spec::Align;
+        spec.align = str[0];
+        return 1;
+    }
+    return 0;
+}
+
+// [[fill]align][width], the part of a spec which a formatter<T> does not see,
+// returns how many characters it takes
+constexpr std::size_t parse_layout(std::string_view str, Spec &spec)
+{
+    spec = Spec();
+    std::size_t pos = parse_align(str, spec);
+    if (pos < str.size() && is_digit(str[pos]))
+    {
+        parse_count(str, pos, spec.width, spec, Spec::Width, Spec::WidthArg);
+    }
+    if (spec.has_set(Spec::Align) && !spec.has_set(Spec::Width))
+    {
+        throw std::invalid_argument("Invalid format spec");
+    }
+    return pos;
+}
+
+// format_spec := [[fill]align][sign]['#']['0'][width]['.' precision][type]
+// false when str is not a valid spec for the built-in types
+constexpr bool parse_spec(std::string_view str, Spec &spec)
+{
+    spec = Spec();
+    std::size_t pos = parse_align(str, spec);
+
+    if (pos < str.size() && is_sign(str[pos]))
+    {
+        spec.mode |= Spec::Sign;
+        spec.sign = str[pos++];
+    }
+
+    bool alternate = pos < str.size() && str[pos] == '#';
+    if (alternate)
+    {
+        ++pos;
+    }
+
+    // a leading 0 is the padding flag unless it is the 0$ width argument
+    if (pos + 1 < str.size() && str[pos] == '0' && str[pos + 1] != '$')
+    {
+        spec.mode |= Spec::Padding;
+        ++pos;
+    }
+
+    if (pos < str.size() && is_digit(str[pos]))
+    {
+        parse_count(str, pos, spec.width, spec, Spec::Width, Spec::WidthArg);
+    }
+
+    if (pos < str.size() && str[pos] == '.')
+    {
+        ++pos;
+        if (pos == str.size() || !is_digit(str[pos]))
+        {
+            return false;
+        }
+        parse_count(str, pos, spec.precision, spec, Spec::Precision, Spec::PreciArg);
+    }
+
+    if (pos < str.size() && is_type(str[pos]))
+    {
+        spec.mode |= Spec::Type;
+        spec.type = str[pos++];
+    }
+
+    return pos == str.size()
+        && !(spec.has_set(Spec::Align) && (!spec.has_set(Spec::Width) || spec.has_set(Spec::Padding)))
+        && !(spec.has_set(Spec::Padding) && !spec.has_set(Spec::Width))
+        && !(alternate && !spec.has_set(Spec::Type));
+}
+
+// memchr at runtime, which libc vectorizes, and a plain loop in constant evaluation
+constexpr std::size_t find_char(std::string_view str, char chr, std::size_t pos)
+{
+    if (pos >= str.size())
+    {
+        return std::string_view::npos;
+    }
+    if (!std::is_constant_evaluated())
+    {
+        auto found = static_cast<const char *>(std::memchr(str.data() + pos, chr, str.size() - pos));
+        return found ? found - str.data() : std::string_view::npos;
+    }
+    for (; pos < str.size(); ++pos)
+    {
+        if (str[pos] == chr)
+        {
+            return pos;
+        }
+    }
+    return std::string_view::npos;
+}
+
+// a literal run [begin, end) of the pattern, or a placeholder for argument
+// index whose spec text starts at text_begin
+template<std::size_t SpecCapacity>
+struct Segment
+{
+    std::size_t     begin       = 0;
+    std::size_t     end         = 0;
+    std::size_t     index       = 0;
+    bool            is_arg      = false;
+    std::uint32_t   text_begin  = 0;
+    Spec            spec;
+    SpecText<SpecCapacity> text;
+};
+
+// splits pattern into segments, segments may be null to only count them and
+// find the longest spec text
+template<std::size_t SpecCapacity>
+constexpr std::size_t parse_pattern(std::string_view pattern, Segment<SpecCapacity> *segments, std::size_t *max_spec = nullptr)
+{
+    std::size_t count = 0;
+    std::size_t arg_ind = 0;
+    std::size_t last_literal = std::string_view::npos;
+
+    auto add_literal = [&](std::size_t begin, std::size_t end)
+    {
+        if (begin == end)
+        {
+            return;
+        }
+        // the kept { of an escape continues the run in front of it
+        if (begin == last_literal)
+        {
+            if (segments)
+            {
+                segments[count - 1].end = end;
+            }
+        }
+        else
+        {
+            if (segments)
+            {
+                segments[count].begin = begin;
+                segments[count].end = end;
+            }
+            ++count;
+        }
+        last_literal = end;
+    };
+
+    std::size_t i = 0;
+    while (i < pattern.size())
+    {
+        auto pos = find_char(pattern, '{', i);
+        if (pos == std::string_view::npos)
+        {
+            add_literal(i, pattern.size());
+            break;
+        }
+        add_literal(i, pos);
+
+        if (pos + 1 == pattern.size())
+        {
+            throw std::invalid_argument("Use {{ or {...} but not only {");
+        }
+        // escaping {
+        if (pattern[pos + 1] == '{')
+        {
+            add_literal(pos, pos + 1);
+            i = pos + 2;
+            continue;
+        }
+
+        auto end_pos = find_char(pattern, '}', pos + 1);
+        if (end_pos == std::string_view::npos)
+        {
+            throw std::invalid_argument("Use {{ or {...} but not only {");
+        }
+
+        Segment<SpecCapacity> segment;
+        segment.is_arg = true;
+        // simplest placeholder {}
+        if (end_pos == pos + 1)
+        {
+            segment.index = arg_ind++;
+        }
+        else
+        {
+            auto field = pattern.substr(pos + 1, end_pos - pos - 1);
+            auto colon_pos = field.find(':');
+            segment.index = as_size_t(field.substr(0, colon_pos));
+            if (colon_pos != std::string_view::npos)
+            {
+                // checked against the argument type once it is known, as a
+                // formatter may accept specs which the built-in types do not
+                auto text = field.substr(colon_pos + 1);
+                if (max_spec)
+                {
+                    *max_spec = std::max(*max_spec, text.size());
+                }
+                if constexpr (SpecCapacity != 0)
+                {
+                    std::copy_n(text.data(), text.size(), segment.text.data.data());
+                }
+                segment.text_begin = static_cast<std::uint32_t>(pos + 2 + colon_pos);
+                segment.text.size = static_cast<std::uint32_t>(text.size());
+                segment.text.is_valid = parse_spec(text, segment.spec);
+                if (!segment.text.is_valid)
+                {
+                    segment.spec = Spec();
+                }
+            }
+        }
+        if (segments)
+        {
+            segments[count] = segment;
+        }
+        ++count;
+        last_literal = std::string_view::npos;
+        i = end_pos + 1;
+    }
+    return count;
+}
+
+template<FixedString pattern>
+inline constexpr std::size_t spec_capacity = []()
+{
+    std::size_t max_spec = 0;
+    parse_pattern<0>(pattern.view(), nullptr, &max_spec);
+    return std::max<std::size_t>(32, (max_spec + 31) / 32 * 32);
+}();
+
+// the pattern parsed once into a flat array which format and size_bound fold over
+template<FixedString pattern>
+inline constexpr auto plan = []()
+{
+    std::array<Segment<spec_capacity<pattern>>, parse_pattern<0>(pattern.view(), nullptr)> segments;
+    parse_pattern(pattern.view(), segments.data());
+    return segments;
+}();
+
+// reading plan entries through this keeps the plan itself out of the object file
+template<auto value>
+inline constexpr auto constant = value;
+
+// a formatter<T> which has parsed the part of a spec after its layout
+template<typename T>
+constexpr formatter<T> make_formatter(std::string_view spec)
+{
+    formatter<T> result;
+    if constexpr (requires { result.parse(spec); })
+    {
+        result.parse(spec);
+    }
+    else if (!spec.empty())
+    {
+        throw std::invalid_argument("Invalid format spec");
+    }
+    return result;
+}
+
+// the layout and the parsed formatter of a placeholder with a formatter type,
+// so the spec is parsed, and rejected, at compile time
+template<typename T, SpecText text>
+inline constexpr auto custom_spec = []()
+{
+    Spec layout;
+    auto rest = text.view().substr(parse_layout(text.view(), layout));
+    return std::make_pair(layout, make_formatter<T>(rest));
+}();
+
+// keyed by the placeholder alone so that every pattern shares the instantiations
+template<bool is_arg, std::size_t index, Spec spec, SpecText text, typename OutputIt, typename ...Args>
+constexpr OutputIt write_segment(OutputIt out, const std::tuple<Args...> &args, const char *literal, std::size_t size)
+{
+    if constexpr (!is_arg)
+    {
+        return write_str(out, literal, size);
+    }
+    else
+    {
+        static_assert(index < sizeof...(Args), "Too few arguments");
+        using Arg = std::tuple_element_t<index, std::tuple<Args...>>;
+        if constexpr (has_formatter_v<std::decay_t<Arg>>)
+        {
+            constexpr auto &custom = custom_spec<std::decay_t<Arg>, text>;
+            return write_formatted(out, std::get<index>(args), resolve_spec<custom.first, Arg>(args), custom.second);
+        }
+        else
+        {
+            static_assert(text.is_valid, "Invalid format spec");
+            return write_arg(out, std::get<index>(args), resolve_spec<spec, Arg>(args));
+        }
+    }
+}
+
+template<FixedString pattern, typename OutputIt, typename ...Args, std::size_t ...indices>
+constexpr OutputIt format_impl(OutputIt out, const std::tuple<Args...> &args, std::index_sequence<indices...>)
+{
+    constexpr auto &segments = plan<pattern>;
+    ((out = write_segment<segments[indices].is_arg, segments[indices].index, segments[indices].spec, segments[indices].text>(
+        out, args, pattern.data + constant<segments[indices].begin>, constant<segments[indices].end - segments[indices].begin>)), ...);
+    return out;
+}
+
+template<FixedString pattern, typename OutputIt, typename ...Args>
+constexpr OutputIt format_impl(OutputIt out, const std::tuple<Args...> &args)
+{
+    return format_impl<pattern>(out, args, std::make_index_sequence<plan<pattern>.size()>());
+}
+
+// bounded LRU map from runtime pattern text to its parsed segments
+class PatternCache
+{
+public:
+    using Plan = std::shared_ptr<const std::vector<Segment<0>>>;
+
+    explicit PatternCache(std::size_t capacity) : capacity_(capacity)
+    {
+        // ...
+    }
+
+    Plan get(std::string_view pattern)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            auto it = entries_.find(pattern);
+            if (it != entries_.end())
+            {
+                order_.splice(order_.begin(), order_, it->second.first);
+                return it->second.second;
+            }
+        }
+
+        // parse outside the lock, a racing thread parsing the same text is harmless
+        auto segments = std::make_shared<std::vector<Segment<0>>>(parse_pattern<0>(pattern, nullptr));
+        parse_pattern(pattern, segments->data());
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto it = entries_.find(pattern);
+        if (it != entries_.end())
+        {
+            return it->second.second;
+        }
+        if (capacity_ == 0)
+        {
+            return segments;
+        }
+
+        order_.emplace_front(pattern);
+        entries_.emplace(order_.front(), std::make_pair(order_.begin(), segments));
+        evict();
+        return segments;
+    }
+
+    void set_capacity(std::size_t capacity)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        capacity_ = capacity;
+        evict();
+    }
+
+private:
+    void evict()
+    {
+        while (entries_.size() > capacity_)
+        {
+            entries_.erase(order_.back());
+            order_.pop_back();
+        }
+    }
+
+    std::mutex mutex_;
+    std::size_t capacity_;
+    // keys of entries_ view the strings owned by order_
+    std::list<std::string> order_;
+    std::unordered_map<std::string_view, std::pair<std::list<std::string>::iterator, Plan>> entries_;
+};
+
+inline PatternCache &pattern_cache()
+{
+    static PatternCache cache(256);
+    return cache;
+}
+
+// an argument of vformat with its type erased behind function pointers
+struct ErasedArg
+{
+    const void *value;
+    // custom is the spec after the layout, which only types with a formatter take
+    void (*write)(std::string &str, const void *value, const Spec &spec, std::string_view custom);
+    std::size_t (*to_size)(const void *value);
+    bool has_formatter;
+};
+
+template<typename T>
+inline ErasedArg make_erased_arg(const T &value)
+{
+    using RT = std::decay_t<T>;
+
+    ErasedArg arg;
+    arg.value = &value;
+    arg.write = [](std::string &str, const void *value, const Spec &spec, std::string_view custom)
+    {
+        if constexpr (has_formatter_v<RT>)
+        {
+            write_formatted(std::back_inserter(str), *static_cast<const T *>(value), spec, make_formatter<RT>(custom));
+        }
+        else
+        {
+            check_spec<RT>(spec);
+            write_arg(std::back_inserter(str), *static_cast<const T *>(value), spec);
+        }
+    };
+    arg.to_size = [](const void *value) -> std::size_t
+    {
+        if constexpr (std::is_integral_v<RT>)
+        {
+            return *static_cast<const T *>(value);
+        }
+        else
+        {
+            throw std::invalid_argument("Width and precision arguments must be integers");
+        }
+    };
+    arg.has_formatter = has_formatter_v<RT>;
+    return arg;
+}
+
+inline std::string &vformat_impl(std::string &str, std::string_view pattern, const ErasedArg *args, std::size_t size)
+{
+    auto arg_at = [&](std::size_t index) -> const ErasedArg &
+    {
+        if (index >= size)
+        {
+            throw std::invalid_argument("Too few arguments");
+        }
+        return args[index];
+    };
+
+    auto segments = pattern_cache().get(pattern);
+    for (const auto &segment : *segments)
+    {
+        if (!segment.is_arg)
+        {
+            str.append(pattern.data() + segment.begin, segment.end - segment.begin);
+            continue;
+        }
+
+        const auto &arg = arg_at(segment.index);
+        auto spec = segment.spec;
+        std::string_view custom;
+        if (arg.has_formatter)
+        {
+            auto text = pattern.substr(segment.text_begin, segment.text.size);
+            custom = text.substr(parse_layout(text, spec));
+        }
+        else if (!segment.text.is_valid)
+        {
+            throw std::invalid_argument("Invalid format spec");
+        }
+
+        if (spec.has_set(Spec::WidthArg))
+        {
+            spec.width = arg_at(spec.width).to_size(arg_at(spec.width).value);
+        }
+        if (spec.has_set(Spec::PreciArg))
+        {
+            spec.precision = arg_at(spec.precision).to_size(arg_at(spec.precision).value);
+        }
+        arg.write(str, arg.value, spec, custom);
+    }
+    return str;
+}
+
+// per-thread staging buffer so print hands each line to the stream in one write
+inline std::string &print_buffer()
+{
+    thread_local std::string buffer;
+    buffer.clear();
+    return buffer;
+}
+
+// a single oversized message should not pin its buffer for the thread's lifetime
+inline constexpr std::size_t max_print_buffer = 1 << 16;
+
+inline void release_print_buffer(std::string &buffer)
+{
+    if (buffer.capacity() > max_print_buffer)
+    {
+        std::string().swap(buffer);
+    }
+}
+
+inline void lock_file(std::FILE *file)
+{
+#if defined(_WIN32)
+    _lock_file(file);
+#else
+    flockfile(file);
+#endif
+}
+
+inline void unlock_file(std::FILE *file)
+{
+#if defined(_WIN32)
+    _unlock_file(file);
+#else
+    funlockfile(file);
+#endif
+}
+
+inline constexpr std::size_t unbounded = static_cast<std::size_t>(-1);
+
+constexpr std::size_t add_bound(std::size_t lhs, std::size_t rhs)
+{
+    return (lhs == unbounded || rhs == unbounded) ? unbounded : lhs + rhs;
+}
+
+// upper bound of what write_arg<spec> emits for an argument of type T
+template<Spec spec, typename T>
+constexpr std::size_t arg_size_bound()
+{
+    using RT = std::remove_cvref_t<T>;
+
+    if constexpr (has_formatter_v<RT> || spec.has_set(Spec::WidthArg) || spec.has_set(Spec::PreciArg))
+    {
+        return unbounded;
+    }
+    else if constexpr (std::is_array_v<RT> && std::is_same_v<std::remove_cv_t<std::remove_extent_t<RT>>, char>)
+    {
+        // a literal may be narrower on screen than in bytes, so all of the width may be fill,
+        // and escaped each byte takes up to six; an array without a NUL, const or not, is
+        // written whole, so the bound is its extent rather than that of a literal
+        constexpr std::size_t escaped = spec.type == '?' || spec.type == 'j' ? 6 : 1;
+        return std::extent_v<RT> * escaped + (escaped > 1 ? 2 : 0) + spec.width * spec.fill_size;
+    }
+    else if constexpr (std::is_integral_v<RT>)
+    {
+        using Limits = std::numeric_limits<RT>;
+        // the magnitude of a negative number needs one more bit
+        constexpr std::size_t bits = Limits::digits + (Limits::is_signed ? 1 : 0);
+
+        std::size_t digits;
+        if constexpr (!spec.has_set(Spec::Type))
+        {
+            digits = Limits::digits10 + 1;
+        }
+        else if constexpr (spec.type == 'x' || spec.type == 'X')
+        {
+            digits = (bits + 3) / 4 + 2;
+        }
+        else if constexpr (spec.type == 'b')
+        {
+            digits = bits + 2;
+        }
+        else
+        {
+            digits = (bits + 2) / 3 + 2;
+        }
+        return std::max<std::size_t>(digits + 1, spec.width * spec.fill_size);
+    }
+    else
+    {
+        return unbounded;
+    }
+}
+
+template<FixedString pattern, std::size_t index, typename Tuple>
+constexpr std::size_t segment_size_bound()
+{
+    constexpr auto segment = plan<pattern>[index];
+    if constexpr (!segment.is_arg)
+    {
+        return segment.end - segment.begin;
+    }
+    else
+    {
+        static_assert(segment.index < std::tuple_size_v<Tuple>, "Too few arguments");
+        return arg_size_bound<segment.spec, std::tuple_element_t<segment.index, Tuple>>();
+    }
+}
+
+template<FixedString pattern, typename Tuple, std::size_t ...indices>
+constexpr std::size_t size_bound(std::index_sequence<indices...>)
+{
+    std::size_t bound = 0;
+    ((bound = add_bound(bound, segment_size_bound<pattern, indices, Tuple>())), ...);
+    return bound;
+}
+
+// sums literal text and argument bounds over the plan
+template<FixedString pattern, typename Tuple>
+constexpr std::size_t size_bound()
+{
+    return size_bound<pattern, Tuple>(std::make_index_sequence<plan<pattern>.size()>());
+}
+
+template<FixedString pattern>
+constexpr std::size_t literal_size()
+{
+    std::size_t size = 0;
+    for (auto &segment : plan<pattern>)
+    {
+        size += segment.is_arg ? 0 : segment.end - segment.begin;
+    }
+    return size;
+}
+
+template<typename T>
+constexpr std::size_t arg_size_hint(const T &arg)
+{
+    using RT = std::remove_cvref_t<T>;
+
+    if constexpr (has_formatter_v<RT>)
+    {
+        return 0;
+    }
+    else if constexpr (std::is_convertible_v<RT, std::string_view> && !std::is_pointer_v<RT>)
+    {
+        return as_string_view(arg).size();
+    }
+    else if constexpr (is_byte_range_v<RT>)
+    {
+        // two hex digits per byte, and longer as a list of numbers
+        return 2 * std::size(arg);
+    }
+    else if constexpr (std::is_integral_v<RT> && !std::is_same_v<RT, bool>)
+    {
+        // the decimal size, so that a number next to a long string does not
+        // grow the buffer once the string is in
+        return integer_size(arg, Spec());
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+template<typename ...Args, std::size_t ...indices>
+constexpr std::size_t args_size_hint(const std::tuple<Args...> &args, std::index_sequence<indices...>)
+{
+    return (0 + ... + arg_size_hint(std::get<indices>(args)));
+}
+
+// literal text plus the strings whose length is known without strlen, the
+// integers and the byte buffers, reserved up front so that long strings are copied into the
+// buffer once rather than again on each growth
+template<FixedString pattern, typename ...Args>
+constexpr std::size_t size_hint(const std::tuple<Args...> &args)
+{
+    return constant<literal_size<pattern>()> + args_size_hint(args, std::index_sequence_for<Args...>());
+}
+
+#ifdef FMT_ENABLE_STATS
+// counters of one compile-time pattern, updated by every format_into with it
+struct PatternStats
+{
+    explicit PatternStats(std::string_view pattern) : pattern(pattern)
+    {
+        // ...
+    }
+
+    std::string_view pattern;
+    std::atomic<std::uint64_t> calls {0};
+    std::atomic<std::uint64_t> total_bytes {0};
+    std::atomic<std::uint64_t> max_bytes {0};
+    // calls whose buffer was reallocated up front and those where it grew while formatting
+    std::atomic<std::uint64_t> allocations {0};
+    std::atomic<std::uint64_t> ticks {0};
+};
+
+class StatsRegistry
+{
+public:
+    PatternStats &add(std::string_view pattern)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return entries_.emplace_back(pattern);
+    }
+
+    template<typename Visitor>
+    void visit(Visitor &&visitor)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (auto &entry : entries_)
+        {
+            visitor(entry);
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    // a list so that the counters never move once handed out
+    std::list<PatternStats> entries_;
+};
+
+inline StatsRegistry &stats_registry()
+{
+    static StatsRegistry registry;
+    return registry;
+}
+
+// registered on the first call with the pattern
+template<FixedString pattern>
+inline PatternStats &pattern_stats()
+{
+    static PatternStats &stats = stats_registry().add(pattern.view());
+    return stats;
+}
+
+// TSC cycles on x86, steady_clock nanoseconds elsewhere
+inline std::uint64_t stats_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline void store_max(std::atomic<std::uint64_t> &value, std::uint64_t candidate)
+{
+    auto current = value.load(std::memory_order_relaxed);
+    while (current < candidate && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed))
+    {
+        // ...
+    }
+}
+
+// format_into with the call recorded in the counters of pattern; the mean
+// output of earlier calls also serves as the size hint when it is larger
+template<FixedString pattern, typename Buffer, typename ...Args>
+inline void format_recorded(Buffer &buffer, const std::tuple<Args...> &args)
+{
+    auto &stats = pattern_stats<pattern>();
+    auto start = stats_ticks();
+    auto before = buffer.size();
+
+    std::uint64_t allocations = 0;
+    if constexpr (requires { buffer.reserve(buffer.size()); buffer.capacity(); })
+    {
+        auto calls = stats.calls.load(std::memory_order_relaxed);
+        auto learned = calls ? stats.total_bytes.load(std::memory_order_relaxed) / calls : 0;
+        auto capacity = buffer.capacity();
+        buffer.reserve(before + std::max<std::size_t>(size_hint<pattern>(args), learned));
+        allocations += buffer.capacity() != capacity;
+
+        capacity = buffer.capacity();
+        format_impl<pattern>(std::back_inserter(buffer), args);
+        allocations += buffer.capacity() != capacity;
+    }
+    else
+    {
+        format_impl<pattern>(std::back_inserter(buffer), args);
+    }
+
+    auto bytes = buffer.size() - before;
+    stats.calls.fetch_add(1, std::memory_order_relaxed);
+    stats.total_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    store_max(stats.max_bytes, bytes);
+    stats.allocations.fetch_add(allocations, std::memory_order_relaxed);
+    stats.ticks.fetch_add(stats_ticks() - start, std::memory_order_relaxed);
+}
+#endif
+
+// formats count rows from first, each a tuple, pair or array of arguments;
+// the first row sizes the buffer for all of them
+template<FixedString pattern, typename It, typename Buffer>
+inline void format_rows(It first, std::size_t count, std::string_view separator, Buffer &sink)
+{
+    auto out = std::back_inserter(sink);
+    for (std::size_t i = 0; i < count; ++i, ++first)
+    {
+        if (i != 0)
+        {
+            out = write_str(out, separator.data(), separator.size());
+        }
+
+        auto before = sink.size();
+        std::apply([&](const auto &...args)
+        {
+            out = format_impl<pattern>(out, std::forward_as_tuple(args...));
+        }, *first);
+
+        if (i == 0 && count > 1)
+        {
+            sink.reserve(sink.size() + (sink.size() - before + separator.size()) * (count - 1));
+        }
+    }
+}
+} // namespace details
+
+// growable character buffer keeping the first N bytes inline, it only
+// allocates from Alloc once the contents outgrow them
+template<std::size_t N = 500, typename Alloc = std::allocator<char>>
+class basic_memory_buffer
+{
+    static_assert(std::is_same_v<typename Alloc::value_type, char>, "Invalid allocator");
+
+public:
+    using value_type = char;
+    using allocator_type = Alloc;
+
+    explicit basic_memory_buffer(const Alloc &alloc = Alloc()) : alloc_(alloc)
+    {
+        // ...
+    }
+
+    basic_memory_buffer(basic_memory_buffer &&other) : alloc_(std::move(other.alloc_))
+    {
+        if (other.data_ == other.store_)
+        {
+            std::copy_n(other.store_, other.size_, store_);
+            size_ = other.size_;
+        }
+        else
+        {
+            data_ = other.data_;
+            size_ = other.size_;
+            capacity_ = other.capacity_;
+            other.data_ = other.store_;
+            other.capacity_ = N;
+        }
+        other.size_ = 0;
+    }
+
+    basic_memory_buffer(const basic_memory_buffer &) = delete;
+    basic_memory_buffer &operator=(const basic_memory_buffer &) = delete;
+
+    ~basic_memory_buffer()
+    {
+        deallocate();
+    }
+
+    char *data()                { return data_; }
+    const char *data() const    { return data_; }
+    std::size_t size() const    { return size_; }
+    std::size_t capacity() const { return capacity_; }
+    char *begin()               { return data_; }
+    char *end()                 { return data_ + size_; }
+    const char *begin() const   { return data_; }
+    const char *end() const     { return data_ + size_; }
+
+    char &operator[](std::size_t i)             { return data_[i]; }
+    const char &operator[](std::size_t i) const { return data_[i]; }
+
+    std::string_view view() const
+    {
+        return std::string_view(data_, size_);
+    }
+
+    std::string str() const
+    {
+        return std::string(data_, size_);
+    }
+
+    void clear()
+    {
+        size_ = 0;
+    }
+
+    void reserve(std::size_t capacity)
+    {
+        if (capacity > capacity_)
+        {
+            grow(capacity);
+        }
+    }
+
+    void resize(std::size_t size)
+    {
+        reserve(size);
+        size_ = size;
+    }
+
+    void push_back(char chr)
+    {
+        reserve(size_ + 1);
+        data_[size_++] = chr;
+    }
+
+    void append(const char *str, std::size_t size)
+    {
+        reserve(size_ + size);
+        std::copy_n(str, size, data_ + size_);
+        size_ += size;
+    }
 
-        constexpr auto rspec = as_spec<pattern, begin + 1, end, Spec::Align>();
-        static_assert(rspec.has_set(Spec::Width), "Invalid format spec");
-        static_assert(!rspec.has_set(Spec::Padding), "Invalid format spec");
+    void append(std::size_t count, char chr)
+    {
+        reserve(size_ + count);
+        std::fill_n(data_ + size_, count, chr);
+        size_ += count;
+    }
 
-        auto spec = rspec;
-        spec.mode |= Spec::Align;
-        spec.fill = ' ';
-        spec.align = pattern[begin];
-        return spec;
+private:
+    void grow(std::size_t capacity)
+    {
+        capacity = std::max(capacity, capacity_ * 2);
+        char *data = std::allocator_traits<Alloc>::allocate(alloc_, capacity);
+        std::copy_n(data_, size_, data);
+        deallocate();
+        data_ = data;
+        capacity_ = capacity;
+    }
+
+    void deallocate()
+    {
+        if (data_ != store_)
+        {
+            std::allocator_traits<Alloc>::deallocate(alloc_, data_, capacity_);
+        }
+    }
+
+    char *data_ = store_;
+    std::size_t size_ = 0;
+    std::size_t capacity_ = N;
+    [[no_unique_address]] Alloc alloc_;
+    char store_[N];
+};
+
+using memory_buffer = basic_memory_buffer<>;
+
+struct hex_options
+{
+    std::size_t group = 0;              // bytes per group, 0 for a single group per line
+    std::string_view separator = " ";   // between groups
+    std::size_t line = 0;               // bytes per line, 0 for a single line
+    bool ascii = false;                 // printable bytes after each line, '.' for the others
+    bool upper = false;
+};
+
+// a byte buffer written as hex, e.g. "{}" of fmt::hex(payload, {.group = 2, .line = 16, .ascii = true})
+struct hex_view
+{
+    const unsigned char *data;
+    std::size_t size;
+    hex_options options;
+};
+
+inline hex_view hex(const void *data, std::size_t size, const hex_options &options = {})
+{
+    return hex_view { static_cast<const unsigned char *>(data), size, options };
+}
+
+template<typename Range>
+inline std::enable_if_t<details::is_byte_range_v<Range>, hex_view> hex(const Range &range, const hex_options &options = {})
+{
+    return hex(std::data(range), std::size(range), options);
+}
+
+namespace details
+{
+template<typename OutputIt, typename View>
+inline OutputIt write_hex_view(OutputIt out, const View &view)
+{
+    const auto &options = view.options;
+    std::size_t line = options.line ? options.line : view.size;
+    std::size_t group = options.group ? options.group : line;
+    auto line_width = [&](std::size_t bytes)
+    {
+        return 2 * bytes + (bytes ? (bytes - 1) / group : 0) * options.separator.size();
+    };
+
+    for (std::size_t begin = 0; begin < view.size; begin += line)
+    {
+        if (begin != 0)
+        {
+            out = write_char(out, '\n');
+        }
+
+        std::size_t bytes = std::min(line, view.size - begin);
+        for (std::size_t offset = 0; offset < bytes; offset += group)
+        {
+            if (offset != 0)
+            {
+                out = write_str(out, options.separator.data(), options.separator.size());
+            }
+            out = write_hex(out, view.data + begin + offset, std::min(group, bytes - offset), options.upper);
+        }
+
+        if (options.ascii)
+        {
+            // a short last line is padded so that its text lines up with the others
+            out = write_fill(out, line_width(line) - line_width(bytes) + 2, ' ');
+            for (std::size_t i = 0; i < bytes; ++i)
+            {
+                auto chr = view.data[begin + i];
+                out = write_char(out, (chr >= 0x20 && chr < 0x7F) ? static_cast<char>(chr) : '.');
+            }
+        }
+    }
+    return out;
+}
+} // namespace details
+
+template<details::FixedString pattern, typename OutputIt, typename ...Args>
+constexpr OutputIt format_to(OutputIt out, Args &&...args)
+{
+    return details::format_impl<pattern>(out, std::forward_as_tuple(std::forward<Args>(args)...));
+}
+
+// appends to buffer (a std::string, basic_memory_buffer, ...), so a buffer
+// reused across calls keeps its capacity
+template<details::FixedString pattern, typename Buffer, typename ...Args>
+constexpr Buffer &format_into(Buffer &buffer, Args &&...args)
+{
+    auto tuple = std::forward_as_tuple(std::forward<Args>(args)...);
+#ifdef FMT_ENABLE_STATS
+    if (!std::is_constant_evaluated())
+    {
+        details::format_recorded<pattern>(buffer, tuple);
+        return buffer;
+    }
+#endif
+    if constexpr (requires { buffer.reserve(buffer.size()); })
+    {
+        buffer.reserve(buffer.size() + details::size_hint<pattern>(tuple));
+    }
+    details::format_impl<pattern>(std::back_inserter(buffer), tuple);
+    return buffer;
+}
+
+template<details::FixedString pattern, typename ...Args>
+constexpr std::string format(Args &&...args)
+{
+    std::string result;
+    format_into<pattern>(result, std::forward<Args>(args)...);
+    return result;
+}
+
+// the result is allocated from alloc, e.g. a std::pmr::polymorphic_allocator<char>
+// over a per-request arena
+template<details::FixedString pattern, typename Alloc, typename ...Args>
+constexpr auto format(std::allocator_arg_t, Alloc &&alloc, Args &&...args)
+{
+    std::basic_string<char, std::char_traits<char>, std::decay_t<Alloc>> result(alloc);
+    format_into<pattern>(result, std::forward<Args>(args)...);
+    return result;
+}
+
+// how format_many splits its rows across threads
+struct parallel_options
+{
+    std::size_t threads = 0;            // 0 for std::thread::hardware_concurrency()
+    std::size_t threshold = 1 << 16;    // smaller inputs are formatted on the calling thread
+};
+
+// formats every row of rows (tuples, pairs or arrays of arguments) with
+// pattern into sink, separated by separator
+template<details::FixedString pattern, typename Range, typename Buffer>
+inline Buffer &format_many(const Range &rows, std::string_view separator, Buffer &sink)
+{
+    details::format_rows<pattern>(std::begin(rows), std::size(rows), separator, sink);
+    return sink;
+}
+
+// the same with the rows split into one contiguous chunk per thread; the
+// per-thread buffers are appended to sink in order
+template<details::FixedString pattern, typename Range, typename Buffer>
+inline Buffer &format_many(const Range &rows, std::string_view separator, Buffer &sink, const parallel_options &options)
+{
+    static_assert(std::random_access_iterator<decltype(std::begin(rows))>, "Rows must be a random access range");
+
+    std::size_t size = std::size(rows);
+    std::size_t threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::size_t chunks = std::min(threads, size);
+    if (size < options.threshold || chunks < 2)
+    {
+        return format_many<pattern>(rows, separator, sink);
+    }
+
+    std::vector<std::string> buffers(chunks);
+    details::parallel_chunks(size, chunks, [&](std::size_t chunk, std::size_t begin, std::size_t end)
+    {
+        details::format_rows<pattern>(std::begin(rows) + begin, end - begin, separator, buffers[chunk]);
+    });
+
+    std::size_t total = sink.size();
+    for (auto &buffer : buffers)
+    {
+        total += buffer.size() + separator.size();
+    }
+    sink.reserve(total);
+
+    auto out = std::back_inserter(sink);
+    for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+    {
+        if (chunk != 0)
+        {
+            out = details::write_str(out, separator.data(), separator.size());
+        }
+        out = details::write_str(out, buffers[chunk].data(), buffers[chunk].size());
+    }
+    return sink;
+}
+
+// runtime patterns, parsed on first use and then served from a bounded cache
+template<typename ...Args>
+inline std::string &vformat_into(std::string &str, std::string_view pattern, const Args &...args)
+{
+    std::array<details::ErasedArg, sizeof...(Args)> erased { details::make_erased_arg(args)... };
+    return details::vformat_impl(str, pattern, erased.data(), erased.size());
+}
+
+template<typename ...Args>
+inline std::string vformat(std::string_view pattern, const Args &...args)
+{
+    std::string result;
+    vformat_into(result, pattern, args...);
+    return result;
+}
+
+inline void set_pattern_cache_capacity(std::size_t capacity)
+{
+    details::pattern_cache().set_capacity(capacity);
+}
+
+// how large random access containers are split across threads, with a
+// higher threshold than format_many as one container is a single argument
+struct container_parallel_options
+{
+    std::size_t threads = 0;                                // 0 for std::thread::hardware_concurrency()
+    std::size_t threshold = details::container_threshold;   // smaller containers are formatted on the calling thread
+};
+
+// random access containers with at least options.threshold elements are
+// formatted on options.threads threads; the output is the same as the serial one
+inline void set_container_parallelism(const container_parallel_options &options)
+{
+    details::parallel_threshold.store(options.threshold, std::memory_order_relaxed);
+    details::parallel_threads.store(options.threads, std::memory_order_relaxed);
+}
+
+#ifdef FMT_ENABLE_STATS
+// what format_into, and so format, print and async_logger, recorded for one pattern
+struct pattern_stats
+{
+    std::string pattern;
+    std::uint64_t calls;
+    std::uint64_t total_bytes;
+    std::uint64_t max_bytes;
+    std::uint64_t allocations;
+    std::uint64_t ticks;    // TSC cycles on x86, nanoseconds elsewhere
+};
+
+enum class stats_format
+{
+    text,
+    json,
+};
+
+// every pattern used so far, the most expensive first
+inline std::vector<pattern_stats> stats()
+{
+    std::vector<pattern_stats> result;
+    details::stats_registry().visit([&](const details::PatternStats &entry)
+    {
+        result.push_back({std::string(entry.pattern),
+                          entry.calls.load(std::memory_order_relaxed),
+                          entry.total_bytes.load(std::memory_order_relaxed),
+                          entry.max_bytes.load(std::memory_order_relaxed),
+                          entry.allocations.load(std::memory_order_relaxed),
+                          entry.ticks.load(std::memory_order_relaxed)});
+    });
+    std::stable_sort(result.begin(), result.end(), [](const pattern_stats &lhs, const pattern_stats &rhs)
+    {
+        return lhs.ticks > rhs.ticks;
+    });
+    return result;
+}
+
+// a table with one row per pattern, or a JSON array of objects
+inline std::string dump_stats(stats_format as = stats_format::text)
+{
+    // written with format_impl so that the dump does not record itself
+    std::string result;
+    auto out = std::back_inserter(result);
+    auto entries = stats();
+    if (as == stats_format::text)
+    {
+        out = details::format_impl<"{0:>10} {1:>12} {2:>10} {3:>10} {4:>14}  {5}\n">(out,
+            std::forward_as_tuple("calls", "bytes", "max", "allocs", "ticks", "pattern"));
+        for (auto &entry : entries)
+        {
+            out = details::format_impl<"{0:>10} {1:>12} {2:>10} {3:>10} {4:>14}  ">(out,
+                std::forward_as_tuple(entry.calls, entry.total_bytes, entry.max_bytes, entry.allocations, entry.ticks));
+            out = details::write_escaped(out, entry.pattern, false);
+            out = details::write_char(out, '\n');
+        }
+        return result;
+    }
+
+    out = details::write_char(out, '[');
+    for (std::size_t i = 0; i < entries.size(); ++i)
+    {
+        out = details::format_impl<"{}\n  {{\"pattern\": ">(out, std::forward_as_tuple(i ? "," : ""));
+        out = details::write_escaped(out, entries[i].pattern, false);
+        out = details::format_impl<", \"calls\": {}, \"total_bytes\": {}, \"max_bytes\": {}, \"allocations\": {}, \"ticks\": {}}">(out,
+            std::forward_as_tuple(entries[i].calls, entries[i].total_bytes, entries[i].max_bytes, entries[i].allocations, entries[i].ticks));
+    }
+    out = details::format_impl<"{}]\n">(out, std::forward_as_tuple(entries.empty() ? "" : "\n"));
+    return result;
+}
+
+inline void reset_stats()
+{
+    details::stats_registry().visit([](details::PatternStats &entry)
+    {
+        entry.calls.store(0, std::memory_order_relaxed);
+        entry.total_bytes.store(0, std::memory_order_relaxed);
+        entry.max_bytes.store(0, std::memory_order_relaxed);
+        entry.allocations.store(0, std::memory_order_relaxed);
+        entry.ticks.store(0, std::memory_order_relaxed);
+    });
+}
+#endif
+
+template<details::FixedString pattern, typename ...Args>
+constexpr std::size_t formatted_size(Args &&...args)
+{
+    return format_to<pattern>(details::counting_iterator(), std::forward<Args>(args)...).count;
+}
+
+// fixed-capacity string living entirely inside the object
+template<std::size_t N>
+struct static_string
+{
+    std::array<char, N + 1> buffer {};
+    std::size_t length = 0;
+
+    constexpr const char *data() const
+    {
+        return buffer.data();
+    }
+
+    constexpr const char *c_str() const
+    {
+        return buffer.data();
+    }
+
+    constexpr std::size_t size() const
+    {
+        return length;
+    }
+
+    static constexpr std::size_t capacity()
+    {
+        return N;
+    }
+
+    constexpr std::string_view view() const
+    {
+        return std::string_view(buffer.data(), length);
+    }
+
+    constexpr operator std::string_view() const
+    {
+        return view();
+    }
+};
+
+// returns a static_string when the output size of pattern with Args is
+// bounded at compile time, otherwise a std::string sized exactly up front
+template<details::FixedString pattern, typename ...Args>
+constexpr auto format_static(Args &&...args)
+{
+    constexpr auto bound = details::size_bound<pattern, std::tuple<Args...>>();
+
+    if constexpr (bound != details::unbounded)
+    {
+        static_string<bound> result;
+        auto end = format_to<pattern>(result.buffer.data(), std::forward<Args>(args)...);
+        result.length = end - result.buffer.data();
+        return result;
+    }
+    else
+    {
+        std::string result;
+        result.reserve(formatted_size<pattern>(args...));
+        format_to<pattern>(std::back_inserter(result), std::forward<Args>(args)...);
+        return result;
+    }
+}
+
+// string arguments of static_format, e.g. fmt::fixed_string{"users"}
+template<std::size_t N>
+using fixed_string = details::FixedString<N>;
+
+// pattern formatted with constant arguments at compile time into a
+// fixed_string of exactly the output size, which lives in read-only data
+template<details::FixedString pattern, auto ...args>
+inline constexpr auto static_format = []()
+{
+    fixed_string<formatted_size<pattern>(args...) + 1> result;
+    format_to<pattern>(result.data, args...);
+    return result;
+}();
+
+// pattern with its arguments, formatted only when it is written out; as an
+// argument of another format call it is written straight into the outer
+// output. Args are const references for lvalues, which it must not outlive,
+// and values for temporaries, which are moved in
+template<details::FixedString pattern, typename ...Args>
+class lazy_format
+{
+public:
+    template<typename ...Ts>
+    constexpr explicit lazy_format(std::in_place_t, Ts &&...args) : args_(std::forward<Ts>(args)...)
+    {
+    }
+
+    template<typename OutputIt>
+    constexpr OutputIt format_to(OutputIt out) const
+    {
+        return details::format_impl<pattern>(out, args_);
+    }
+
+    template<typename Buffer>
+    constexpr Buffer &format_into(Buffer &buffer) const
+    {
+        format_to(std::back_inserter(buffer));
+        return buffer;
+    }
+
+    constexpr std::size_t size() const
+    {
+        return format_to(details::counting_iterator()).count;
+    }
+
+    constexpr std::string str() const
+    {
+        std::string result;
+        format_to(std::back_inserter(result));
+        return result;
+    }
+
+    constexpr explicit operator std::string() const
+    {
+        return str();
+    }
+
+private:
+    std::tuple<Args...> args_;
+};
+
+namespace details
+{
+template<typename T>
+using lazy_capture_t = std::conditional_t<std::is_lvalue_reference_v<T>, const std::remove_reference_t<T> &, std::remove_cvref_t<T>>;
+} // namespace details
+
+template<details::FixedString pattern, typename ...Args>
+constexpr lazy_format<pattern, details::lazy_capture_t<Args>...> lazy(Args &&...args)
+{
+    return lazy_format<pattern, details::lazy_capture_t<Args>...>(std::in_place, std::forward<Args>(args)...);
+}
+
+template<details::FixedString pattern, typename ...Args>
+struct formatter<lazy_format<pattern, Args...>>
+{
+    template<typename OutputIt>
+    constexpr OutputIt format(const lazy_format<pattern, Args...> &value, OutputIt out) const
+    {
+        return value.format_to(out);
+    }
+};
+
+namespace details
+{
+template<typename T>
+struct is_lazy_format : std::false_type {};
+template<FixedString pattern, typename ...Args>
+struct is_lazy_format<lazy_format<pattern, Args...>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_lazy_format_v = is_lazy_format<T>::value;
+} // namespace details
+
+// how far fmt::scan got: position is where the segment which failed starts,
+// or the end of the match, and count the number of arguments assigned
+struct scan_result
+{
+    std::size_t position = 0;
+    std::size_t count = 0;
+    bool matched = false;
+
+    constexpr explicit operator bool() const
+    {
+        return matched;
+    }
+};
+
+namespace details
+{
+// whether write_padded puts fill in front of and behind a field, which is
+// left aligned unless told otherwise, numbers included
+constexpr std::pair<bool, bool> fill_sides(const Spec &spec)
+{
+    if (!spec.has_set(Spec::Width) || spec.has_set(Spec::Padding))
+    {
+        return {false, false};
+    }
+    return {spec.align != '<', spec.align != '>'};
+}
+
+// skips the fill of a padded field
+inline std::size_t skip_fill(std::string_view input, std::size_t pos, const Spec &spec)
+{
+    std::string_view fill(spec.fill.data(), spec.fill_size);
+    while (input.substr(pos, fill.size()) == fill)
+    {
+        pos += fill.size();
+    }
+    return pos;
+}
+
+// a number written with spec: the sign and the prefix of x, b and o are
+// optional, and so is the fill where write_padded would put it
+template<typename T>
+inline bool scan_number(std::string_view input, std::size_t &pos, T &value, const Spec &spec)
+{
+    auto [before, after] = fill_sides(spec);
+    auto at = before ? skip_fill(input, pos, spec) : pos;
+    bool negative = at < input.size() && input[at] == '-';
+    at += at < input.size() && (input[at] == '+' || input[at] == '-');
+
+    int base = 10;
+    char prefix = 0;
+    switch (spec.type)
+    {
+    case 'x': case 'X':
+        base = 16;
+        prefix = 'x';
+        break;
+    case 'b':
+        base = 2;
+        prefix = 'b';
+        break;
+    case 'o':
+        base = 8;
+        prefix = 'o';
+        break;
+    }
+    if (prefix && at + 1 < input.size() && input[at] == '0' && (input[at + 1] | 0x20) == prefix)
+    {
+        at += 2;
+    }
+
+    auto first = input.data() + at;
+    auto last = input.data() + input.size();
+    std::from_chars_result result;
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        unsigned number = 0;
+        result = std::from_chars(first, last, number, base);
+        value = number != 0;
+        result.ec = number > 1 ? std::errc::result_out_of_range : result.ec;
     }
-    else if constexpr (is_sign(pattern[begin]))
+    else if constexpr (std::is_integral_v<T>)
     {
-        static_assert(anchor < Spec::Sign, "Invalid format spec");
-
-        auto spec = as_spec<pattern, begin + 1, end, Spec::Sign>();
-        spec.mode |= Spec::Sign;
-        spec.sign = pattern[begin];
-        return spec;
+        // the sign is already taken, so the magnitude is read unsigned and negated
+        std::make_unsigned_t<T> magnitude = 0;
+        result = std::from_chars(first, last, magnitude, base);
+        constexpr auto max = static_cast<std::make_unsigned_t<T>>(std::numeric_limits<T>::max());
+        if (negative && !std::is_signed_v<T>)
+        {
+            result.ec = std::errc::invalid_argument;
+        }
+        else if (magnitude > max + (negative ? 1u : 0u))
+        {
+            result.ec = std::errc::result_out_of_range;
+        }
+        value = static_cast<T>(negative ? 0 - magnitude : magnitude);
+    }
+    else
+    {
+        auto format = spec.type == 'x' || spec.type == 'X' ? std::chars_format::hex
+                    : spec.type == 'e' || spec.type == 'E' ? std::chars_format::scientific : std::chars_format::general;
+        result = std::from_chars(first, last, value, format);
+        value = negative ? -value : value;
     }
-    else if constexpr (pattern[begin] == '#')
+    if (result.ec != std::errc() || result.ptr == first)
     {
-        static_assert(anchor < Spec::Type, "Invalid format spec");
-
-        constexpr auto spec = as_spec<pattern, begin + 1, end, Spec::Type>();
-        static_assert(spec.has_set(Spec::Type), "Invalid format spec");
-        return spec;
+        return false;
     }
-    else if constexpr (pattern[begin] == '0')
+
+    pos = result.ptr - input.data();
+    pos = after ? skip_fill(input, pos, spec) : pos;
+    return true;
+}
+
+// one segment of fmt::scan, keyed by the placeholder like write_segment; a
+// string runs up to stop, the literal text after it, or to the end of input
+template<bool is_arg, std::size_t index, Spec spec, SpecText text, typename ...Args>
+inline bool scan_segment(std::string_view input, scan_result &result, const std::tuple<Args &...> &args,
+                         std::string_view literal, std::string_view stop)
+{
+    auto &pos = result.position;
+    if constexpr (!is_arg)
     {
-        if constexpr (pattern[begin + 1] == '$')
+        if (input.size() - pos < literal.size() || std::memcmp(input.data() + pos, literal.data(), literal.size()) != 0)
         {
-            static_assert(anchor < Spec::Width, "Invalid format spec");
+            return false;
+        }
+        pos += literal.size();
+        return true;
+    }
+    else
+    {
+        static_assert(index < sizeof...(Args), "Too few arguments");
+        static_assert(text.is_valid, "Invalid format spec");
+        using T = std::remove_cvref_t<std::tuple_element_t<index, std::tuple<Args...>>>;
+        auto &arg = std::get<index>(args);
 
-            auto spec = as_spec<pattern, begin + 2, end, Spec::Width>();
-            spec.mode |= Spec::WidthArg;
-            spec.width = 0;
-            return spec;
+        if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>)
+        {
+            auto end = stop.empty() ? input.size() : input.find(stop, pos);
+            if (end == std::string_view::npos)
+            {
+                return false;
+            }
+            auto value = input.substr(pos, end - pos);
+            auto [before, after] = fill_sides(spec);
+            std::string_view fill(spec.fill.data(), spec.fill_size);
+            while (before && value.starts_with(fill))
+            {
+                value.remove_prefix(fill.size());
+            }
+            while (after && value.ends_with(fill))
+            {
+                value.remove_suffix(fill.size());
+            }
+            arg = T(value);
+            pos = end;
         }
         else
         {
-            static_assert(anchor < Spec::Padding, "Invalid format spec");
+            static_assert(std::is_arithmetic_v<T>, "Only numbers and strings can be scanned");
+            auto at = pos;
+            if (!scan_number(input, at, arg, spec))
+            {
+                return false;
+            }
+            pos = at;
+        }
+        ++result.count;
+        return true;
+    }
+}
+
+// the literal text after segment index, which ends a string in front of it
+template<FixedString pattern, std::size_t index>
+constexpr std::pair<std::size_t, std::size_t> scan_stop()
+{
+    constexpr auto &segments = plan<pattern>;
+    if constexpr (index + 1 < segments.size() && !segments[index + 1].is_arg)
+    {
+        return {segments[index + 1].begin, segments[index + 1].end};
+    }
+    return {0, 0};
+}
+
+template<FixedString pattern, typename ...Args, std::size_t ...indices>
+inline scan_result scan_impl(std::string_view input, const std::tuple<Args &...> &args, std::index_sequence<indices...>)
+{
+    constexpr auto &segments = plan<pattern>;
+    scan_result result;
+    auto view = [](std::size_t begin, std::size_t end)
+    {
+        return std::string_view(pattern.data + begin, end - begin);
+    };
+    result.matched = (scan_segment<segments[indices].is_arg, segments[indices].index, segments[indices].spec, segments[indices].text>(
+        input, result, args, view(constant<segments[indices].begin>, constant<segments[indices].end>),
+        view(constant<scan_stop<pattern, indices>().first>, constant<scan_stop<pattern, indices>().second>)) && ...);
+    return result;
+}
+} // namespace details
 
-            constexpr auto rspec = as_spec<pattern, begin + 1, end, Spec::Padding>();
-            static_assert(rspec.has_set(Spec::Width), "Invalid format spec");
+// the inverse of format: matches input against pattern and assigns the
+// numbers and strings (std::string, or std::string_view into input) found
+// at its placeholders to args
+template<details::FixedString pattern, typename ...Args>
+inline scan_result scan(std::string_view input, Args &...args)
+{
+    return details::scan_impl<pattern>(input, std::tie(args...), std::make_index_sequence<details::plan<pattern>.size()>());
+}
 
-            auto spec = rspec;
-            spec.mode |= Spec::Padding;
-            return spec;
+namespace details
+{
+// digits after the point for Duration, enough to show every tick exactly
+// when its period is a power of ten, and 6 otherwise
+template<typename Duration>
+constexpr std::size_t fraction_digits()
+{
+    using Period = typename Duration::period;
+    std::intmax_t scale = 1;
+    for (std::size_t digits = 0; digits < 19; ++digits, scale *= 10)
+    {
+        if (scale % Period::den == 0)
+        {
+            return digits;
         }
     }
-    else if constexpr (is_digit(pattern[begin]))
+    return 6;
+}
+
+// value in exactly width digits, with leading zeros
+template<typename OutputIt>
+inline OutputIt write_digits(OutputIt out, std::uint64_t value, std::size_t width)
+{
+    char buffer[20];
+    for (std::size_t i = width; i-- > 0; value /= 10)
     {
-        static_assert(anchor < Spec::Width, "Invalid format spec");
+        buffer[i] = static_cast<char>('0' + value % 10);
+    }
+    return write_str(out, buffer, width);
+}
 
-        constexpr auto pos = pattern.find_consequent_digit(begin + 1, end);
-        if constexpr (pattern[pos] == '$')
+// checks a strftime-like spec and returns how many %f it holds
+constexpr std::size_t check_time_spec(std::string_view spec)
+{
+    std::size_t fractions = 0;
+    for (std::size_t i = 0; i < spec.size(); ++i)
+    {
+        if (spec[i] != '%')
         {
-            auto spec = as_spec<pattern, pos + 1, end, Spec::Width>();
-            spec.mode |= Spec::WidthArg;
-            spec.width = as_size_t<pattern>(begin, pos);
-            return spec;
+            continue;
         }
-        else
+        if (++i == spec.size() || std::string_view("YymdHMSfFTabzZ%").find(spec[i]) == std::string_view::npos)
         {
-            auto spec = as_spec<pattern, pos, end, Spec::Width>();
-            spec.mode |= Spec::Width;
-            spec.width = as_size_t<pattern>(begin, pos);
-            return spec;
+            throw std::invalid_argument("Invalid time spec");
         }
+        fractions += spec[i] == 'f';
     }
-    else if constexpr (pattern[begin] == '.')
+    return fractions;
+}
+
+// where the first %f conversion starts, skipping %% as check_time_spec does,
+// or spec.size() without one
+constexpr std::size_t find_fraction(std::string_view spec)
+{
+    for (std::size_t i = 0; i + 1 < spec.size(); ++i)
     {
-        static_assert(anchor < Spec::Precision, "Invalid format spec");
-        static_assert(begin + 1 < end, "Invalid format spec");
+        if (spec[i] == '%')
+        {
+            if (spec[i + 1] == 'f')
+            {
+                return i;
+            }
+            ++i;
+        }
+    }
+    return spec.size();
+}
 
-        constexpr auto pos = pattern.find_consequent_digit(begin + 1, end);
-        if constexpr (pattern[pos] == '$')
+// spec rendered for time in UTC, with fraction for %f
+template<typename OutputIt>
+inline OutputIt write_time(OutputIt out, std::string_view spec, std::chrono::sys_seconds time, std::string_view fraction)
+{
+    static constexpr std::string_view weekdays[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static constexpr std::string_view months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+    auto days = std::chrono::floor<std::chrono::days>(time);
+    std::chrono::year_month_day date(days);
+    std::chrono::hh_mm_ss clock(time - days);
+    int year = static_cast<int>(date.year());
+
+    std::size_t pos = 0;
+    while (pos < spec.size())
+    {
+        auto next = std::min(find_char(spec, '%', pos), spec.size());
+        out = write_str(out, spec.data() + pos, next - pos);
+        if (next == spec.size())
         {
-            auto spec = as_spec<pattern, pos + 1, end, Spec::Precision>();
-            spec.mode |= Spec::PreciArg;
-            spec.precision = as_size_t<pattern>(begin + 1, pos);
-            return spec;
+            break;
         }
-        else
+        if (next + 1 == spec.size())
+        {
+            out = write_char(out, '%');
+            break;
+        }
+
+        std::string_view name;
+        switch (spec[next + 1])
         {
-            auto spec = as_spec<pattern, pos, end, Spec::Precision>();
-            spec.mode |= Spec::Precision;
-            spec.precision = as_size_t<pattern>(begin + 1, pos);
-            return spec;
+        case 'Y':
+            out = 0 <= year && year <= 9999 ? write_digits(out, year, 4) : write_integer(out, year, Spec());
+            break;
+        case 'y':
+            out = write_digits(out, (year % 100 + 100) % 100, 2);
+            break;
+        case 'm':
+            out = write_digits(out, static_cast<unsigned>(date.month()), 2);
+            break;
+        case 'd':
+            out = write_digits(out, static_cast<unsigned>(date.day()), 2);
+            break;
+        case 'H':
+            out = write_digits(out, clock.hours().count(), 2);
+            break;
+        case 'M':
+            out = write_digits(out, clock.minutes().count(), 2);
+            break;
+        case 'S':
+            out = write_digits(out, clock.seconds().count(), 2);
+            break;
+        case 'f':
+            out = write_str(out, fraction.data(), fraction.size());
+            break;
+        case 'F':
+            out = write_time(out, "%Y-%m-%d", time, fraction);
+            break;
+        case 'T':
+            out = write_time(out, "%H:%M:%S", time, fraction);
+            break;
+        case 'a':
+            name = weekdays[std::chrono::weekday(days).c_encoding()];
+            out = write_str(out, name.data(), name.size());
+            break;
+        case 'b':
+            name = months[static_cast<unsigned>(date.month()) - 1];
+            out = write_str(out, name.data(), name.size());
+            break;
+        case 'z':
+            out = write_str(out, "+0000", 5);
+            break;
+        case 'Z':
+            out = write_str(out, "UTC", 3);
+            break;
+        default:
+            out = write_char(out, '%');
+            break;
         }
+        pos = next + 2;
     }
-    else if constexpr (is_type(pattern[begin]))
-    {
-        static_assert(anchor <= Spec::Precision && begin + 1 == end, "Invalid format spec");
+    return out;
+}
+
+// the last second rendered on this thread, split around its %f; consecutive
+// timestamps within one second only render their fraction
+struct TimeCache
+{
+    std::string spec;
+    std::chrono::sys_seconds second = std::chrono::sys_seconds::min();
+    std::string before;
+    std::string after;
+};
+
+inline TimeCache &time_cache()
+{
+    thread_local TimeCache cache;
+    return cache;
+}
 
-        Spec spec;
-        spec.mode = Spec::Type;
-        spec.type = pattern[begin];
-        return spec;
+// the unit suffix of a duration, as std::format writes it
+template<typename Period, typename OutputIt>
+constexpr OutputIt write_unit(OutputIt out)
+{
+    using namespace std;
+    constexpr string_view unit =
+        is_same_v<Period, atto>               ? "as"  : is_same_v<Period, femto>       ? "fs" :
+        is_same_v<Period, pico>               ? "ps"  : is_same_v<Period, nano>        ? "ns" :
+        is_same_v<Period, micro>              ? "us"  : is_same_v<Period, milli>       ? "ms" :
+        is_same_v<Period, centi>              ? "cs"  : is_same_v<Period, deci>        ? "ds" :
+        is_same_v<Period, ratio<1>>           ? "s"   : is_same_v<Period, deca>        ? "das" :
+        is_same_v<Period, hecto>              ? "hs"  : is_same_v<Period, kilo>        ? "ks" :
+        is_same_v<Period, mega>               ? "Ms"  : is_same_v<Period, giga>        ? "Gs" :
+        is_same_v<Period, ratio<60>>          ? "min" : is_same_v<Period, ratio<3600>> ? "h" :
+        is_same_v<Period, ratio<86400>>       ? "d"   : "";
+
+    if constexpr (!unit.empty())
+    {
+        return write_str(out, unit.data(), unit.size());
     }
     else
     {
-        throw std::invalid_argument("Invalid format spec");
+        out = write_char(out, '[');
+        out = write_integer(out, Period::num, Spec());
+        if constexpr (Period::den != 1)
+        {
+            out = write_integer(write_char(out, '/'), Period::den, Spec());
+        }
+        return write_str(out, "]s", 2);
     }
 }
+} // namespace details
 
-template<FixedString pattern, std::size_t i, std::size_t arg_ind, typename ...Args>
-inline std::string format_impl(const std::tuple<Args...> &args)
+// system_clock time points in UTC; {} is %F %T, with .%f when the clock ticks
+// faster than once a second, and a spec takes %Y %y %m %d %H %M %S %F %T %a
+// %b %z %Z %% and %f, the digits of the fraction of the second
+template<typename Duration>
+struct formatter<std::chrono::time_point<std::chrono::system_clock, Duration>>
 {
-    using Tuple = std::tuple<Args...>;
+    static constexpr std::size_t digits = details::fraction_digits<Duration>();
+    using Fraction = std::chrono::duration<std::int64_t, std::ratio<1, []()
+    {
+        std::intmax_t scale = 1;
+        for (std::size_t i = 0; i < digits; ++i)
+        {
+            scale *= 10;
+        }
+        return scale;
+    }()>>;
 
-    static_assert(i <= pattern.size, "Error! Please report!");
+    std::string_view spec = digits ? "%F %T.%f" : "%F %T";
+    std::size_t fractions = digits ? 1 : 0;
 
-    if constexpr (i == pattern.size)
+    constexpr void parse(std::string_view text)
     {
-        return std::string();
+        if (!text.empty())
+        {
+            spec = text;
+            fractions = details::check_time_spec(text);
+        }
     }
-    else if constexpr (pattern[i] == '{')
+
+    template<typename OutputIt>
+    OutputIt format(const std::chrono::time_point<std::chrono::system_clock, Duration> &value, OutputIt out) const
     {
-        static_assert(i + 1 < pattern.size, "Use {{ or {...} but not only {");
+        auto second = std::chrono::floor<std::chrono::seconds>(value);
 
-        // escaping {
-        if constexpr (pattern[i + 1] == '{')
+        char fraction[20] {};
+        if (fractions != 0)
         {
-            return '{' + format_impl<pattern, i + 2, arg_ind>(args);
+            details::write_digits(fraction, std::chrono::duration_cast<Fraction>(value - second).count(), digits);
         }
-        // simplest placeholder {}
-        else if constexpr (pattern[i + 1] == '}')
+        std::string_view digits_view(fraction, digits);
+
+        if (fractions > 1)
         {
-            static_assert(arg_ind < std::tuple_size_v<Tuple>, "Too few arguments");
-            return as_string(std::get<arg_ind>(args), args) + format_impl<pattern, i + 2, arg_ind + 1>(args);
+            return details::write_time(out, spec, second, digits_view);
         }
-        else
-        {
-            constexpr auto end_pos = pattern.find('}', i + 1);
-            static_assert(end_pos != pattern.size, "Use {{ or {...} but not only {");
 
-            constexpr auto colon_pos = pattern.find(':', i + 1, end_pos);
-            if constexpr (colon_pos < end_pos)
+        auto &cache = details::time_cache();
+        if (cache.second != second || cache.spec != spec)
+        {
+            auto split = details::find_fraction(spec);
+            cache.before.clear();
+            cache.after.clear();
+            details::write_time(std::back_inserter(cache.before), spec.substr(0, split), second, "");
+            if (split != spec.size())
             {
-                constexpr auto position = as_size_t<pattern>(i + 1, colon_pos);
-                static_assert(position < std::tuple_size_v<Tuple>, "Positional parameters not match");
-                return as_string<as_spec<pattern, colon_pos + 1, end_pos>()>(std::get<position>(args), args)
-                    + format_impl<pattern, end_pos + 1, arg_ind>(args)
-                ;
+                details::write_time(std::back_inserter(cache.after), spec.substr(split + 2), second, "");
             }
-            else
+            cache.spec = spec;
+            cache.second = second;
+        }
+
+        out = details::write_str(out, cache.before.data(), cache.before.size());
+        if (fractions != 0)
+        {
+            out = details::write_str(out, digits_view.data(), digits_view.size());
+            out = details::write_str(out, cache.after.data(), cache.after.size());
+        }
+        return out;
+    }
+};
+
+// a count and its unit, 42ms, 1.5s or 3[1/30]s
+template<typename Rep, typename Period>
+struct formatter<std::chrono::duration<Rep, Period>>
+{
+    template<typename OutputIt>
+    constexpr OutputIt format(const std::chrono::duration<Rep, Period> &value, OutputIt out) const
+    {
+        return details::write_unit<Period>(details::write_value(out, value.count()));
+    }
+};
+
+template<details::FixedString pattern, typename ...Args>
+inline int print(std::FILE *file, Args &&...args)
+{
+    auto &buffer = details::print_buffer();
+    format_into<pattern>(buffer, std::forward<Args>(args)...);
+
+    details::lock_file(file);
+    std::fwrite(buffer.data(), 1, buffer.size(), file);
+    int error = std::ferror(file);
+    details::unlock_file(file);
+
+    details::release_print_buffer(buffer);
+    return error;
+}
+
+template<details::FixedString pattern, typename Stream, typename ...Args>
+inline std::enable_if_t<std::is_base_of_v<std::ostream, Stream>, int> print(Stream &os, Args &&...args)
+{
+    auto &buffer = details::print_buffer();
+    format_into<pattern>(buffer, std::forward<Args>(args)...);
+
+    std::ostream::sentry sentry(os);
+    if (sentry)
+    {
+        auto size = static_cast<std::streamsize>(buffer.size());
+        if (os.rdbuf()->sputn(buffer.data(), size) != size)
+        {
+            os.setstate(std::ios_base::badbit);
+        }
+    }
+
+    details::release_print_buffer(buffer);
+    return os.fail() ? 1 : 0;
+}
+
+template<details::FixedString pattern, typename ...Args>
+inline int print(Args &&...args)
+{
+    return print<pattern>(stdout, std::forward<Args>(args)...);
+}
+
+#ifdef FMT_HAS_WRITEV
+namespace details
+{
+#ifdef IOV_MAX
+inline constexpr std::size_t max_iovecs = IOV_MAX;
+#else
+inline constexpr std::size_t max_iovecs = _XOPEN_IOV_MAX;
+#endif
+
+inline constexpr std::size_t in_place = static_cast<std::size_t>(-1);
+
+// points iov at a literal, or at a string argument without width, in place;
+// anything else is formatted onto the end of scratch and its offset returned,
+// since scratch may still move while later arguments are formatted
+template<bool is_arg, std::size_t index, Spec spec, SpecText text, typename ...Args>
+inline std::size_t gather_segment(iovec &iov, std::string &scratch, const std::tuple<Args...> &args,
+                                  const char *literal, std::size_t size)
+{
+    if constexpr (!is_arg)
+    {
+        iov.iov_base = const_cast<char *>(literal);
+        iov.iov_len = size;
+        return in_place;
+    }
+    else
+    {
+        static_assert(index < sizeof...(Args), "Too few arguments");
+        using RT = std::decay_t<std::tuple_element_t<index, std::tuple<Args...>>>;
+        if constexpr (!has_formatter_v<RT> && std::is_convertible_v<RT, std::string_view> && !spec.has_set(Spec::Width)
+                      && spec.type != '?' && spec.type != 'j')
+        {
+            static_assert(text.is_valid, "Invalid format spec");
+            auto str = as_string_view(std::get<index>(args));
+            iov.iov_base = const_cast<char *>(str.data());
+            iov.iov_len = str.size();
+            return in_place;
+        }
+        else
+        {
+            auto begin = scratch.size();
+            write_segment<is_arg, index, spec, text>(std::back_inserter(scratch), args, literal, size);
+            iov.iov_len = scratch.size() - begin;
+            return begin;
+        }
+    }
+}
+
+template<FixedString pattern, typename ...Args, std::size_t ...indices>
+inline void gather(iovec *iovs, std::size_t *offsets, std::string &scratch,
+                   const std::tuple<Args...> &args, std::index_sequence<indices...>)
+{
+    constexpr auto &segments = plan<pattern>;
+    ((offsets[indices] = gather_segment<segments[indices].is_arg, segments[indices].index, segments[indices].spec, segments[indices].text>(
+        iovs[indices], scratch, args, pattern.data + constant<segments[indices].begin>, constant<segments[indices].end - segments[indices].begin>)), ...);
+}
+
+// writes all of iovs, at most max_iovecs at a time and resuming after
+// partial writes and signals; returns 0 or the errno of the failed call
+inline int write_all(int fd, iovec *iovs, std::size_t count)
+{
+    while (count != 0)
+    {
+        auto written = ::writev(fd, iovs, static_cast<int>(std::min(count, max_iovecs)));
+        if (written < 0)
+        {
+            if (errno == EINTR)
             {
-                constexpr auto position = as_size_t<pattern>(i + 1, end_pos);
-                static_assert(position < std::tuple_size_v<Tuple>, "Positional parameters not match");
-                return as_string(std::get<position>(args), args) + format_impl<pattern, end_pos + 1, arg_ind>(args);
+                continue;
             }
+            return errno;
         }
+
+        auto rest = static_cast<std::size_t>(written);
+        while (count != 0 && rest >= iovs->iov_len)
+        {
+            rest -= iovs->iov_len;
+            ++iovs;
+            --count;
+        }
+        if (rest != 0)
+        {
+            iovs->iov_base = static_cast<char *>(iovs->iov_base) + rest;
+            iovs->iov_len -= rest;
+        }
+    }
+    return 0;
+}
+} // namespace details
+
+// writes to the file descriptor fd with one writev per call: literal text and
+// string arguments without a width are pointed at where they are, and only
+// the other arguments are formatted, into a per-thread scratch buffer;
+// returns 0 or the errno of the failed write
+template<details::FixedString pattern, typename ...Args>
+inline int write(int fd, Args &&...args)
+{
+    constexpr std::size_t size = details::plan<pattern>.size();
+    std::array<iovec, size> iovs;
+    std::array<std::size_t, size> offsets;
+
+    auto &scratch = details::print_buffer();
+    details::gather<pattern>(iovs.data(), offsets.data(), scratch,
+        std::forward_as_tuple(std::forward<Args>(args)...), std::make_index_sequence<size>());
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        if (offsets[i] != details::in_place)
+        {
+            iovs[i].iov_base = scratch.data() + offsets[i];
+        }
+    }
+
+    int error = details::write_all(fd, iovs.data(), size);
+    details::release_print_buffer(scratch);
+    return error;
+}
+#endif
+
+enum class overflow_policy
+{
+    block,          // wait for the consumer to free a slot
+    drop,           // discard the message
+    drop_and_count, // discard the message and count it in dropped()
+};
+
+namespace details
+{
+// strings are copied so the message outlives them, except for literals, and
+// lazy messages are formatted, as they only refer to their arguments
+template<typename T>
+using async_capture_t = std::conditional_t<
+    is_literal_v<T>, const char *, std::conditional_t<
+    std::is_convertible_v<std::decay_t<T>, std::string_view> || is_lazy_format_v<std::decay_t<T>>, std::string, std::decay_t<T>>>;
+
+// a mutable buffer is copied up to its NUL, or whole when it has none
+template<typename T>
+decltype(auto) async_capture(T &&arg)
+{
+    if constexpr (std::is_array_v<std::remove_reference_t<T>> && !is_literal_v<T>)
+    {
+        return std::string(as_string_view(arg));
     }
     else
     {
-        constexpr auto pos = pattern.find('{', i + 1);
-        return std::string(pattern.data + i, pos - i) + format_impl<pattern, pos, arg_ind>(args);
+        return std::forward<T>(arg);
     }
 }
+} // namespace details
 
-template<FixedString pattern, std::size_t i, std::size_t arg_ind, typename ...Args>
-inline void print_impl(const std::tuple<Args...> &args)
+// formats and writes messages on a background thread; log() only copies
+// its arguments into a lock-free ring buffer shared by all producers
+class async_logger
 {
-    using Tuple = std::tuple<Args...>;
+public:
+    static constexpr std::size_t inline_capacity = 232;
+
+    explicit async_logger(std::FILE *file = stdout, std::size_t capacity = 4096,
+                          overflow_policy policy = overflow_policy::block)
+      : file_(file), policy_(policy)
+      , capacity_(std::bit_ceil(std::max<std::size_t>(capacity, 2)))
+      , slots_(new Slot[capacity_])
+    {
+        for (std::size_t i = 0; i < capacity_; ++i)
+        {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        consumer_ = std::thread([this]() { consume(); });
+    }
 
-    static_assert(i <= pattern.size, "Error! Please report!");
+    async_logger(const async_logger &) = delete;
+    async_logger &operator=(const async_logger &) = delete;
 
-    if constexpr (i == pattern.size)
+    // writes everything already logged before returning
+    ~async_logger()
     {
-        return;
+        stop_.store(true, std::memory_order_release);
+        wake();
+        consumer_.join();
+        std::fflush(file_);
     }
-    else if constexpr (pattern[i] == '{')
+
+    // returns false when the message was dropped because the buffer was full
+    template<details::FixedString pattern, typename ...Args>
+    bool log(Args &&...args)
     {
-        static_assert(i + 1 < pattern.size, "Use {{ or {...} but not only {");
+        using Tuple = std::tuple<details::async_capture_t<Args>...>;
 
-        // escaping {
-        if constexpr (pattern[i + 1] == '{')
+        std::size_t pos;
+        Slot *slot;
+        while (!(slot = claim(pos)))
         {
-            std::putchar('{');
-            print_impl<pattern, i + 2, arg_ind>(args);
+            if (policy_ != overflow_policy::block)
+            {
+                if (policy_ == overflow_policy::drop_and_count)
+                {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                }
+                return false;
+            }
+            std::this_thread::yield();
         }
-        // simplest placeholder {}
-        else if constexpr (pattern[i + 1] == '}')
+
+        if constexpr (sizeof(Tuple) <= inline_capacity && alignof(Tuple) <= alignof(std::max_align_t))
         {
-            static_assert(arg_ind < std::tuple_size_v<Tuple>, "Too few arguments");
-            std::fputs(as_string(std::get<arg_ind>(args), args).c_str(), stdout);
-            print_impl<pattern, i + 2, arg_ind + 1>(args);
+            new (slot->storage) Tuple(details::async_capture(std::forward<Args>(args))...);
+            slot->write = [](void *storage, std::string &out)
+            {
+                auto tuple = std::launder(reinterpret_cast<Tuple *>(storage));
+                std::apply([&](const auto &...args) { format_into<pattern>(out, args...); }, *tuple);
+                tuple->~Tuple();
+            };
         }
         else
         {
-            constexpr auto end_pos = pattern.find('}', i + 1);
-            static_assert(end_pos != pattern.size, "Use {{ or {...} but not only {");
+            *reinterpret_cast<Tuple **>(slot->storage) = new Tuple(details::async_capture(std::forward<Args>(args))...);
+            slot->write = [](void *storage, std::string &out)
+            {
+                auto tuple = *std::launder(reinterpret_cast<Tuple **>(storage));
+                std::apply([&](const auto &...args) { format_into<pattern>(out, args...); }, *tuple);
+                delete tuple;
+            };
+        }
+
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    // waits until every message logged before the call is written, then flushes the file
+    void flush()
+    {
+        auto target = enqueue_pos_.load(std::memory_order_acquire);
+        auto written = written_.load(std::memory_order_acquire);
+        while (written < target)
+        {
+            written_.wait(written, std::memory_order_acquire);
+            written = written_.load(std::memory_order_acquire);
+        }
+        std::fflush(file_);
+    }
+
+    std::size_t dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
 
-            constexpr auto colon_pos = pattern.find(':', i + 1, end_pos);
-            if constexpr (colon_pos < end_pos)
+private:
+    struct alignas(64) Slot
+    {
+        std::atomic<std::size_t> sequence;
+        void (*write)(void *storage, std::string &out);
+        alignas(std::max_align_t) unsigned char storage[inline_capacity];
+    };
+
+    // bounded MPMC queue by Dmitry Vyukov, used with a single consumer
+    Slot *claim(std::size_t &pos)
+    {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true)
+        {
+            auto &slot = slots_[pos & (capacity_ - 1)];
+            auto sequence = slot.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(sequence - pos);
+            if (diff == 0)
+            {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    return &slot;
+                }
+            }
+            else if (diff < 0)
             {
-                constexpr auto position = as_size_t<pattern>(i + 1, colon_pos);
-                static_assert(position < std::tuple_size_v<Tuple>, "Positional parameters not match");
-                std::fputs(as_string<as_spec<pattern, colon_pos + 1, end_pos>()>(std::get<position>(args), args), stdout);
-                print_impl<pattern, end_pos + 1, arg_ind>(args);
+                return nullptr;
             }
             else
             {
-                constexpr auto position = as_size_t<pattern>(i + 1, end_pos);
-                static_assert(position < std::tuple_size_v<Tuple>, "Positional parameters not match");
-                std::fputs(as_string(std::get<position>(args), args).c_str(), stdout);
-                print_impl<pattern, end_pos + 1, arg_ind>(args);
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
             }
         }
     }
-    else
+
+    void wake()
+    {
+        published_.fetch_add(1, std::memory_order_release);
+        published_.notify_one();
+    }
+
+    void consume()
     {
-        constexpr auto pos = pattern.find('{', i + 1);
-        for (std::size_t index = i; index < pos; ++index)
+        std::string buffer;
+        std::size_t pos = 0;
+        while (true)
         {
-            std::putchar(pattern[index]);
+            auto published = published_.load(std::memory_order_acquire);
+            auto stopping = stop_.load(std::memory_order_acquire);
+
+            auto &slot = slots_[pos & (capacity_ - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) == pos + 1)
+            {
+                slot.write(slot.storage, buffer);
+                slot.sequence.store(pos + capacity_, std::memory_order_release);
+                ++pos;
+                if (buffer.size() < max_batch)
+                {
+                    continue;
+                }
+            }
+
+            if (!buffer.empty())
+            {
+                std::fwrite(buffer.data(), 1, buffer.size(), file_);
+                buffer.clear();
+            }
+            if (written_.load(std::memory_order_relaxed) != pos)
+            {
+                written_.store(pos, std::memory_order_release);
+                written_.notify_all();
+            }
+
+            // pos may have moved past slot when a full batch was written
+            if (slots_[pos & (capacity_ - 1)].sequence.load(std::memory_order_acquire) != pos + 1)
+            {
+                if (stopping)
+                {
+                    break;
+                }
+                published_.wait(published, std::memory_order_acquire);
+            }
         }
-        print_impl<pattern, pos, arg_ind>(args);
     }
-}
-} // namespace details
-
-template<details::FixedString pattern, typename ...Args>
-inline std::string format(Args &&...args)
-{
-    return details::format_impl<pattern, 0, 0>(std::make_tuple(std::forward<Args>(args)...));
-}
 
-template<details::FixedString pattern, typename ...Args>
-inline int print(Args &&...args)
-{
-    details::print_impl<pattern, 0, 0>(std::make_tuple(std::forward<Args>(args)...));
-    return std::ferror(stdout);
-}
+    static constexpr std::size_t max_batch = 1 << 16;
+
+    std::FILE *file_;
+    overflow_policy policy_;
+    std::size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<std::size_t> enqueue_pos_ {0};
+    alignas(64) std::atomic<std::size_t> published_ {0};
+    alignas(64) std::atomic<std::size_t> written_ {0};
+    std::atomic<std::size_t> dropped_ {0};
+    std::atomic<bool> stop_ {false};
+    std::thread consumer_;
+};
 } // namespace fmt
 
 #endif
@@ -1,7 +1,22 @@
 #include "format.hpp"
+#include <new>
+#include <map>
 #include <set>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+#include <span>
 #include <list>
 #include <vector>
+#include <memory_resource>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <functional>
+#include <thread>
+#include <unistd.h>
 #include <gtest/gtest.h>
 
 using namespace std;
@@ -54,11 +69,177 @@ TEST(StaticFormat, Sign_Type_Padding)
     ASSERT_EQ(fmt::format<"{:#x}!">(static_cast<unsigned int>(x)), "0xffffffe5!");
 }
 
+TEST(StaticFormat, Integer)
+{
+    ASSERT_EQ(fmt::format<"{}">(0), "0");
+    ASSERT_EQ(fmt::format<"{} {}">(9, 10), "9 10");
+    ASSERT_EQ(fmt::format<"{}">(std::numeric_limits<int>::min()), "-2147483648");
+    ASSERT_EQ(fmt::format<"{}">(std::numeric_limits<std::uint64_t>::max()), "18446744073709551615");
+    ASSERT_EQ(fmt::format<"{}">(std::numeric_limits<std::int64_t>::min()), "-9223372036854775808");
+    ASSERT_EQ(fmt::format<"{:#x}">(std::numeric_limits<std::uint64_t>::max()), "0xffffffffffffffff");
+    ASSERT_EQ(fmt::format<"{:#X}">(0xabcdeu), "0xABCDE");
+    ASSERT_EQ(fmt::format<"{:#b}">(0), "0b0");
+    ASSERT_EQ(fmt::format<"{:#b}">(std::numeric_limits<std::int8_t>::min()), "-0b10000000");
+    ASSERT_EQ(fmt::format<"{:#o}">(01234567), "0o1234567");
+    ASSERT_EQ(fmt::format<"{:+08}">(42), "+0000042");
+    ASSERT_EQ(fmt::format<"{:#0100b}">(5), "0b" + string(95, '0') + "101");
+    ASSERT_EQ(fmt::format<"{:>+6}|{0:<6}|{0:^7}">(-12), "   -12|-12   |  -12  ");
+}
+
+TEST(StaticFormat, Float)
+{
+    ASSERT_EQ(fmt::format<"{}">(0.1), "0.1");
+    ASSERT_EQ(fmt::format<"{}">(0.1f), "0.1");
+    ASSERT_EQ(fmt::format<"{}">(-1.5), "-1.5");
+    ASSERT_EQ(fmt::format<"{}">(1e300), "1e+300");
+    ASSERT_EQ(fmt::format<"{}">(5.0), "5");
+    ASSERT_EQ(fmt::format<"{}">(0.30000000000000004), "0.30000000000000004");
+    ASSERT_EQ(fmt::format<"{:.2}">(3.14159), "3.14");
+    ASSERT_EQ(fmt::format<"{:.1$}">(3.14159, 3), "3.142");
+    ASSERT_EQ(fmt::format<"{:+.1}">(2.25), "+2.2");
+    ASSERT_EQ(fmt::format<"{:e}">(1234.5), "1.2345e+03");
+    ASSERT_EQ(fmt::format<"{:.2E}">(1234.5), "1.23E+03");
+    ASSERT_EQ(fmt::format<"{:#x}">(1.5), "0x1.8p+0");
+    ASSERT_EQ(fmt::format<"{:#X}">(-1.5), "-0X1.8P+0");
+    ASSERT_EQ(fmt::format<"{:08.2}">(-3.14159), "-0003.14");
+    ASSERT_EQ(fmt::format<"{:>8.2}|{0:<7}|{0:^9}">(3.14159), "    3.14|3.14159| 3.14159 ");
+    ASSERT_EQ(fmt::format<"{:.3}">(1e300).size(), 305);
+    ASSERT_EQ(fmt::format<"{}">(std::numeric_limits<double>::infinity()), "inf");
+    ASSERT_EQ(fmt::format<"{:#x}">(-std::numeric_limits<double>::infinity()), "-inf");
+}
+
 TEST(StaticFormat, Escaping)
 {
     ASSERT_EQ(fmt::format<"{{}">(), "{}");
 }
 
+TEST(StaticFormat, Strings)
+{
+    char buffer[8] = "ab";
+    const char *pointer = "cd";
+    ASSERT_EQ(fmt::format<"{}|{}|{}|{}">(buffer, pointer, std::string("ef"), std::string_view("gh")), "ab|cd|ef|gh");
+
+    // the payload is copied straight into a buffer reserved for it
+    std::string payload(65536, 'x');
+    auto line = fmt::format<"<{}>">(payload);
+    ASSERT_EQ(line.size(), payload.size() + 2);
+    ASSERT_EQ(line.capacity(), line.size());
+}
+
+TEST(StaticFormat, Unicode)
+{
+    ASSERT_EQ(fmt::format<"[{:^6}]">("日本"), "[ 日本 ]");
+    ASSERT_EQ(fmt::format<"[{:*>3}]">("e\u0301"), "[**e\u0301]");
+    ASSERT_EQ(fmt::format<"[{:<4}]">("👨\u200D👩\u200D👧"), "[👨\u200D👩\u200D👧  ]");
+    ASSERT_EQ(fmt::format<"[{:<3}]">(std::string("\xff")), "[\xff  ]");
+    ASSERT_EQ(fmt::format<"[{:>23}]">(std::string(20, 'a') + "é"), "[  " + std::string(20, 'a') + "é]");
+
+    ASSERT_EQ(fmt::format<"{:─^9}">("ab"), "───ab────");
+    ASSERT_EQ(fmt::format<"{:·>5}">(42), "···42");
+    ASSERT_EQ(fmt::format<"{:·<5}">(std::vector{1, 2}), "{1····, 2····}");
+    ASSERT_EQ(fmt::format_static<"{:─^9}">("ab").view(), "───ab────");
+    ASSERT_EQ(fmt::vformat("{:★<4}", "x"), "x★★★");
+}
+
+TEST(StaticFormat, Escaped)
+{
+    ASSERT_EQ(fmt::format<"{:?}">("say \"hi\"\n"), "\"say \\\"hi\\\"\\n\"");
+    ASSERT_EQ(fmt::format<"{:?}">(std::string("\x1b[0m\x7f\t\\")), "\"\\u{1b}[0m\\u{7f}\\t\\\\\"");
+    ASSERT_EQ(fmt::format<"{:j}">(std::string_view("a\x01\b\f\x7f日本")), "\"a\\u0001\\b\\f\x7f日本\"");
+    ASSERT_EQ(fmt::format<"{:*<8?}|{0:>6j}">("a\n"), "\"a\\n\"***| \"a\\n\"");
+    ASSERT_EQ(fmt::format<"{:j}">(std::vector<std::string>{"x", "\"y\""}), "{\"x\", \"\\\"y\\\"\"}");
+    static_assert(fmt::format<"{:?}">("\"") == "\"\\\"\"");
+    ASSERT_EQ(fmt::format_static<"{:j}">("\x01\x02").view(), "\"\\u0001\\u0002\"");
+    ASSERT_THROW(fmt::vformat("{:?}", 1), std::invalid_argument);
+
+    // escapes at every offset of the 16 and 32 byte blocks agree with the plain loop
+    for (std::size_t size : {15, 16, 31, 32, 33, 70})
+    {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            std::string text(size, 'a');
+            text[i] = i % 3 == 0 ? '"' : i % 3 == 1 ? '\\' : '\x1f';
+            std::string expected = "\"" + text.substr(0, i) + (i % 3 == 0 ? "\\\"" : i % 3 == 1 ? "\\\\" : "\\u001f") + text.substr(i + 1) + "\"";
+            ASSERT_EQ(fmt::format<"{:j}">(text), expected);
+        }
+    }
+}
+
+TEST(StaticFormat, HexDump)
+{
+    std::array<std::byte, 4> word {std::byte(0xde), std::byte(0xad), std::byte(0xbe), std::byte(0xef)};
+    ASSERT_EQ(fmt::format<"{}">(word), "deadbeef");
+    ASSERT_EQ(fmt::format<"{:X}">(std::span(word)), "DEADBEEF");
+    ASSERT_EQ(fmt::format<"[{:>10x}]">(word), "[  deadbeef]");
+    ASSERT_EQ(fmt::vformat("{:x}", word), "deadbeef");
+    std::vector<char> chars;
+    fmt::format_to<"{}">(std::back_inserter(chars), word);
+    ASSERT_EQ(std::string(chars.begin(), chars.end()), "deadbeef");
+
+    std::vector<std::uint8_t> small {1, 2, 255};
+    ASSERT_EQ(fmt::format<"{}">(small), "{1, 2, 255}");
+    ASSERT_EQ(fmt::format<"{:x}">(small), "0102ff");
+
+    // every kernel against a plain reference, with lengths around the vector widths
+    std::vector<unsigned char> bytes(1000);
+    std::string expected;
+    for (std::size_t i = 0; i < bytes.size(); ++i)
+    {
+        bytes[i] = static_cast<unsigned char>(i * 7 + 3);
+        expected += "0123456789abcdef"[bytes[i] >> 4];
+        expected += "0123456789abcdef"[bytes[i] & 15];
+    }
+    std::vector<fmt::details::hex_encoder> encoders {fmt::details::hex_encode_scalar};
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        encoders.push_back(fmt::details::hex_encode_ssse3);
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        encoders.push_back(fmt::details::hex_encode_avx2);
+    }
+#endif
+    for (auto encoder : encoders)
+    {
+        for (std::size_t size : {0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 1000})
+        {
+            std::string out(2 * size, '?');
+            encoder(out.data(), bytes.data(), size, false);
+            ASSERT_EQ(out, expected.substr(0, 2 * size));
+        }
+    }
+    ASSERT_EQ(fmt::format<"{:x}">(bytes), expected);
+
+    std::string text = "ABCDEF\n";
+    ASSERT_EQ(fmt::format<"{}">(fmt::hex(text.data(), 2)), "4142");
+    ASSERT_EQ(fmt::format<"{}">(fmt::hex(word, {.group = 1, .separator = ":", .upper = true})), "DE:AD:BE:EF");
+    ASSERT_EQ(fmt::format<"{}">(fmt::hex(text.data(), text.size(), {.group = 2, .line = 4, .ascii = true})),
+              "4142 4344  ABCD\n"
+              "4546 0a    EF.");
+
+    // a hex view only takes its case and a layout
+    ASSERT_EQ(fmt::format<"{:X}|{0:*>6x}">(fmt::hex(text.data(), 2)), "4142|**4142");
+    ASSERT_EQ(fmt::format<"{:X}">(fmt::hex(word, {.group = 1, .separator = ":"})), "DE:AD:BE:EF");
+    for (auto pattern : {"{:+}", "{:.3}", "{:o}", "{:#b}", "{:08}"})
+    {
+        ASSERT_THROW(fmt::vformat(pattern, fmt::hex(text.data(), 2)), std::invalid_argument);
+    }
+}
+
+TEST(StaticFormat, Plan)
+{
+    constexpr auto &plan = fmt::details::plan<"a{{b{1:>3}{}c">;
+    static_assert(plan.size() == 5);
+    static_assert(!plan[0].is_arg && plan[0].begin == 0 && plan[0].end == 2);
+    static_assert(!plan[1].is_arg && plan[1].begin == 3 && plan[1].end == 4);
+    static_assert(plan[2].is_arg && plan[2].index == 1 && plan[2].spec.width == 3 && plan[2].spec.align == '>');
+    static_assert(plan[3].is_arg && plan[3].index == 0 && plan[3].spec.is_default());
+    static_assert(!plan[4].is_arg && plan[4].begin == 12);
+
+    ASSERT_EQ(fmt::format<"a{{b{1:>3}{}c">(1, 2), "a{b  21c");
+}
+
 TEST(StaticFormat, Pair)
 {
     ASSERT_EQ(fmt::format<"Hello, {}!">(make_pair(1, 2)), "Hello, (1, 2)!");
@@ -84,6 +265,398 @@ TEST(StaticFormat, Container)
     ASSERT_EQ(fmt::format<"Hello, {}!">(vec), "Hello, {{1, 2}, {2, 3}, {3, 4}}!");
 }
 
+TEST(StaticFormat, ElementSpec)
+{
+    ASSERT_EQ(fmt::format<"{:#x}">(std::vector<std::uint32_t>{1, 255, 4096}), "{0x1, 0xff, 0x1000}");
+    ASSERT_EQ(fmt::format<"{:.3}">(std::vector{1.0, 0.5}), "{1.000, 0.500}");
+    ASSERT_EQ(fmt::format<"{:>3}">(std::vector{std::vector{1, 2}, std::vector{3}}), "{{  1,   2}, {  3}}");
+    ASSERT_EQ(fmt::format<"{:+}">(make_pair(1, 2.5)), "(+1, +2.5)");
+    ASSERT_EQ(fmt::format<"{:<3}|">(make_tuple("a", 1, 'b')), "(a  , 1  , 98 )|");
+    ASSERT_EQ(fmt::format<"{:#b}">(std::map<int, int>{{1, 2}, {3, 4}}), "{0b1: 0b10, 0b11: 0b100}");
+    ASSERT_EQ(fmt::format<"{}">(std::map<std::string, std::vector<int>>{{"a", {1}}, {"b", {}}}), "{a: {1}, b: {}}");
+    ASSERT_EQ(fmt::vformat("{:#x}", std::vector{10, 11}), "{0xa, 0xb}");
+    ASSERT_THROW(fmt::vformat("{:.1}", std::vector{1}), std::invalid_argument);
+}
+
+TEST(StaticFormat, FormatTo)
+{
+    std::vector<char> vec;
+    fmt::format_to<"{}-{1:>4}-{2:#x}">(std::back_inserter(vec), "a", 1, 27);
+    ASSERT_EQ(string(vec.begin(), vec.end()), "a-   1-0x1b");
+
+    char buf[16] {};
+    auto end = fmt::format_to<"{:^5}|{1}">(buf, "ab", make_pair(1, 2));
+    ASSERT_EQ(string(buf, end), " ab  |(1, 2)");
+}
+
+TEST(StaticFormat, FormatInto)
+{
+    string str = "> ";
+    ASSERT_EQ(fmt::format_into<"{}, {}!">(str, "Hello", "world"), "> Hello, world!");
+
+    str.clear();
+    auto capacity = str.capacity();
+    fmt::format_into<"{}">(str, std::vector{1, 2});
+    ASSERT_EQ(str, "{1, 2}");
+    ASSERT_EQ(str.capacity(), capacity);
+}
+
+TEST(StaticFormat, MemoryBuffer)
+{
+    fmt::basic_memory_buffer<8> buf;
+    fmt::format_into<"{}-{}">(buf, 12, "ab");
+    ASSERT_EQ(buf.view(), "12-ab");
+    ASSERT_EQ(buf.capacity(), 8);
+
+    fmt::format_to<"{:>6}">(std::back_inserter(buf), 'x' - 'w');
+    ASSERT_EQ(buf.view(), "12-ab     1");
+    ASSERT_GE(buf.capacity(), 11);
+
+    auto moved = std::move(buf);
+    ASSERT_EQ(moved.str(), "12-ab     1");
+    ASSERT_EQ(buf.size(), 0);
+
+    fmt::basic_memory_buffer<64> small;
+    fmt::format_into<"{}">(small, std::vector{1, 2});
+    auto inline_moved = std::move(small);
+    ASSERT_EQ(inline_moved.view(), "{1, 2}");
+}
+
+TEST(StaticFormat, Allocator)
+{
+    char storage[256];
+    std::pmr::monotonic_buffer_resource arena(storage, sizeof(storage), std::pmr::null_memory_resource());
+    std::pmr::polymorphic_allocator<char> alloc(&arena);
+
+    auto str = fmt::format<"request {} from {}, a long enough line to leave SSO">(std::allocator_arg, alloc, 42, "client");
+    static_assert(std::is_same_v<decltype(str), std::pmr::string>);
+    ASSERT_EQ(str, "request 42 from client, a long enough line to leave SSO");
+
+    fmt::basic_memory_buffer<4, std::pmr::polymorphic_allocator<char>> buf(alloc);
+    fmt::format_into<"{:#x}">(buf, 0xdeadbeef);
+    ASSERT_EQ(buf.view(), "0xdeadbeef");
+}
+
+TEST(StaticFormat, FormattedSize)
+{
+    ASSERT_EQ(fmt::formatted_size<"Hello, {}!">("world"), 13);
+    ASSERT_EQ(fmt::formatted_size<"{:#010x}|{1:^7}">(27, std::vector{1, 2}), 29);
+}
+
+TEST(StaticFormat, FormatStatic)
+{
+    auto tag = fmt::format_static<"id={:#010x} seq={1:>5} {2}">(27u, -12, "rx");
+    static_assert(std::is_same_v<decltype(tag), fmt::static_string<34>>);
+    ASSERT_EQ(tag.view(), "id=0x0000001b seq=  -12 rx");
+    ASSERT_EQ(string(tag.c_str()), "id=0x0000001b seq=  -12 rx");
+
+    char raw[4] = {'a', 'b', 'c', 'd'};
+    auto bytes = fmt::format_static<"{}{}{}">(raw, raw, raw);
+    static_assert(std::is_same_v<decltype(bytes), fmt::static_string<12>>);
+    ASSERT_EQ(bytes.view(), "abcdabcdabcd");
+    static constexpr char letters[4] = {'A', 'B', 'C', 'D'};
+    auto constant = fmt::format_static<"{}{}">(letters, letters);
+    static_assert(std::is_same_v<decltype(constant), fmt::static_string<8>>);
+    ASSERT_EQ(constant.view(), "ABCDABCD");
+
+    string name = "world";
+    auto str = fmt::format_static<"Hello, {}!">(name);
+    static_assert(std::is_same_v<decltype(str), std::string>);
+    ASSERT_EQ(str, "Hello, world!");
+    ASSERT_EQ(str.capacity(), str.size() < 16 ? 15 : str.size());
+}
+
+TEST(StaticFormat, FormatMany)
+{
+    std::vector<std::tuple<int, std::string, double>> rows;
+    std::string expected;
+    for (int i = 0; i < 10000; ++i)
+    {
+        rows.emplace_back(i, "row" + std::to_string(i), i / 4.0);
+        expected += (i ? "\n" : "") + fmt::format<"{},{},{}">(i, "row" + std::to_string(i), i / 4.0);
+    }
+
+    std::string csv = "header\n";
+    fmt::format_many<"{},{},{}">(rows, "\n", csv);
+    ASSERT_EQ(csv, "header\n" + expected);
+
+    for (std::size_t threads : {2, 3, 7})
+    {
+        fmt::memory_buffer buffer;
+        fmt::format_many<"{},{},{}">(rows, "\n", buffer, {.threads = threads, .threshold = 1});
+        ASSERT_EQ(buffer.view(), expected);
+    }
+
+    std::string pairs;
+    std::vector<std::pair<std::string, int>> few {{"a", 1}, {"b", 2}};
+    fmt::format_many<"{}={1:>2}">(few, ";", pairs, {.threads = 4});
+    ASSERT_EQ(pairs, "a= 1;b= 2");
+}
+
+TEST(StaticFormat, ParallelContainer)
+{
+    std::vector<int> numbers(100000);
+    std::vector<std::string> words(1000);
+    for (std::size_t i = 0; i < numbers.size(); ++i)
+    {
+        numbers[i] = static_cast<int>(i * 7919 % 100003) - 50000;
+    }
+    for (std::size_t i = 0; i < words.size(); ++i)
+    {
+        words[i] = std::string(i % 5, 'w');
+    }
+    std::vector<std::vector<int>> nested(64, std::vector<int>(100, 3));
+
+    auto serial_numbers = fmt::format<"{:>7}">(numbers);
+    auto serial_words = fmt::format<"{}">(words);
+    auto serial_nested = fmt::format<"{}">(nested);
+
+    for (std::size_t threads : {2, 3, 8})
+    {
+        fmt::set_container_parallelism({.threads = threads, .threshold = 2});
+        ASSERT_EQ(fmt::format<"{:>7}">(numbers), serial_numbers);
+        ASSERT_EQ(fmt::format<"[{}]">(words), "[" + serial_words + "]");
+        ASSERT_EQ(fmt::format<"{}">(nested), serial_nested);
+
+        fmt::memory_buffer buffer;
+        fmt::format_into<"{}">(buffer, words);
+        ASSERT_EQ(buffer.view(), serial_words);
+
+        std::vector<char> chars;
+        fmt::format_to<"{}">(std::back_inserter(chars), words);
+        ASSERT_EQ(std::string(chars.begin(), chars.end()), serial_words);
+    }
+    fmt::set_container_parallelism({});
+    ASSERT_EQ(fmt::details::parallel_threshold.load(), 1 << 20);
+    fmt::set_container_parallelism({.threads = 4});
+    ASSERT_EQ(fmt::details::parallel_threshold.load(), 1 << 20);
+    fmt::set_container_parallelism({});
+}
+
+TEST(StaticFormat, Constexpr)
+{
+    static_assert(fmt::format<"{} {1:>4}|{2:#x}|{3}">(42, "ab", 255u, true) == "42   ab|0xff|1");
+    static_assert(fmt::format<"{:─^7}">("日本") == "─日本──");
+    static_assert(fmt::formatted_size<"{}:{}">(-12345, "abc") == 10);
+    static_assert(fmt::format_static<"id={:#010x}">(27u).view() == "id=0x0000001b");
+
+    constexpr auto &banner = fmt::static_format<"v{}.{}-{}", 1, 2, fmt::fixed_string{"rc"}>;
+    static_assert(std::is_same_v<decltype(banner), const fmt::fixed_string<8> &>);
+    static_assert(banner.view() == "v1.2-rc");
+    ASSERT_EQ(std::string_view(banner), "v1.2-rc");
+}
+
+struct Price
+{
+    long cents;
+};
+
+template<>
+struct fmt::formatter<Price>
+{
+    bool in_cents = false;
+
+    constexpr void parse(std::string_view spec)
+    {
+        if (spec == "c")
+        {
+            in_cents = true;
+        }
+        else if (!spec.empty())
+        {
+            throw std::invalid_argument("Invalid price spec");
+        }
+    }
+
+    template<typename OutputIt>
+    constexpr OutputIt format(const Price &price, OutputIt out) const
+    {
+        if (in_cents)
+        {
+            return fmt::format_to<"{}c">(out, price.cents);
+        }
+        return fmt::format_to<"${}.{1:02}">(out, price.cents / 100, price.cents % 100);
+    }
+};
+
+TEST(StaticFormat, Formatter)
+{
+    ASSERT_EQ(fmt::format<"{}">(Price{1234}), "$12.34");
+    ASSERT_EQ(fmt::format<"{:c}|{0:>8}|{0:*<8c}|{0:^1$}">(Price{705}, 9), "705c|   $7.05|705c****|  $7.05  ");
+    ASSERT_EQ(fmt::format<"{}">(std::vector{Price{1}, Price{250}}), "{$0.01, $2.50}");
+    ASSERT_EQ(fmt::format<"{:>6}">(std::make_pair(Price{99}, 1)), "( $0.99,      1)");
+    static_assert(fmt::format<"{:c}">(Price{42}) == "42c");
+
+    ASSERT_EQ(fmt::vformat("{:c} {0:>1$}", Price{5}, 7), "5c   $0.05");
+    ASSERT_THROW(fmt::vformat("{:x}", Price{5}), std::invalid_argument);
+    ASSERT_THROW(fmt::vformat("{:c}", 5), std::invalid_argument);
+}
+
+struct Counted
+{
+    int *count;
+};
+
+template<>
+struct fmt::formatter<Counted>
+{
+    template<typename OutputIt>
+    constexpr OutputIt format(const Counted &value, OutputIt out) const
+    {
+        return fmt::format_to<"#{}">(out, ++*value.count);
+    }
+};
+
+TEST(StaticFormat, Lazy)
+{
+    int count = 0;
+    std::string name = "request";
+    auto message = fmt::lazy<"{} {}">(name, Counted{&count});
+    ASSERT_EQ(count, 0);
+
+    ASSERT_EQ(message.str(), "request #1");
+    // a width formats it twice, once to measure it
+    ASSERT_EQ(fmt::format<"[{}] [{0:*^15}]">(message), "[request #2] [**request #4***]");
+    ASSERT_EQ(std::string(message), "request #5");
+    name = "changed";
+    ASSERT_EQ(fmt::vformat("{:>12}", message), "  changed #7");
+    ASSERT_EQ(fmt::format<"{}">(std::vector{fmt::lazy<"<{}>">(1), fmt::lazy<"<{}>">(2)}), "{<1>, <2>}");
+    ASSERT_EQ(fmt::lazy<"{}{}">(fmt::lazy<"{:x}">(255u), 'a').size(), 6);
+    static_assert(fmt::lazy<"{}-{1:02}">(1, 2).str() == "1-02");
+    static_assert(!std::is_convertible_v<decltype(message), std::string>);
+
+    // temporaries are kept by value, lvalues by reference
+    auto owned = fmt::lazy<"{}{}">(std::string(40, 'z'), name);
+    static_assert(std::is_same_v<decltype(owned), fmt::lazy_format<"{}{}", std::string, const std::string &>>);
+    ASSERT_EQ(owned.str(), std::string(40, 'z') + name);
+
+    std::string out;
+    message.format_into(out);
+    ASSERT_EQ(out, "changed #8");
+
+    // the logger formats it on the calling thread, as it only refers to the arguments
+    auto file = std::tmpfile();
+    {
+        fmt::async_logger logger(file, 4);
+        ASSERT_TRUE(logger.log<"{}\n">(fmt::lazy<"{}: {}">(name, 1)));
+        name = "overwritten";
+    }
+    std::rewind(file);
+    char line[32] {};
+    ASSERT_NE(std::fgets(line, sizeof(line), file), nullptr);
+    ASSERT_STREQ(line, "changed: 1\n");
+    std::fclose(file);
+}
+
+TEST(StaticFormat, Chrono)
+{
+    using namespace std::chrono;
+    sys_time<nanoseconds> time = sys_days{2024y / March / 5} + 13h + 4min + 9s + 123456789ns;
+
+    ASSERT_EQ(fmt::format<"{}">(time), "2024-03-05 13:04:09.123456789");
+    ASSERT_EQ(fmt::format<"{}">(floor<seconds>(time)), "2024-03-05 13:04:09");
+    ASSERT_EQ(fmt::format<"{:%Y-%m-%dT%H:%M:%S.%fZ}">(floor<milliseconds>(time)), "2024-03-05T13:04:09.123Z");
+    ASSERT_EQ(fmt::format<"{:%a %b %d %y %T %z %Z %%}">(floor<seconds>(time)), "Tue Mar 05 24 13:04:09 +0000 UTC %");
+    ASSERT_EQ(fmt::format<"{:*>12%T}|{0:%f,%f}">(floor<microseconds>(time)), "****13:04:09|123456,123456");
+
+    // the cached second is only reused within that second and that spec
+    for (auto offset : {0ms, 1ms, 1000ms, 1001ms})
+    {
+        ASSERT_EQ(fmt::format<"[{:%T.%f}]">(floor<milliseconds>(time) + offset),
+                  offset < 1s ? fmt::vformat("[13:04:09.{}]", 123 + offset.count()) : fmt::vformat("[13:04:10.{}]", offset.count() - 877));
+    }
+    ASSERT_EQ(fmt::format<"{:%H}">(floor<milliseconds>(time)), "13");
+    ASSERT_EQ(fmt::format<"{:%H%%f}|{0:%%%f%%}">(floor<milliseconds>(time)), "13%f|%123%");
+    ASSERT_EQ(fmt::format<"{:%a, %d %b %Y %H:%M:%S.%f %z (%Z) %y}|{0:%T}">(time), "Tue, 05 Mar 2024 13:04:09.123456789 +0000 (UTC) 24|13:04:09");
+    ASSERT_EQ(fmt::vformat("{:%a, %d %b %Y %H:%M:%S.%f %z (%Z) %y}", time), "Tue, 05 Mar 2024 13:04:09.123456789 +0000 (UTC) 24");
+    ASSERT_EQ(fmt::format<"{:%a, %d %b %Y %H:%M:%S.%f %z (%Z) %y}">(time), "Tue, 05 Mar 2024 13:04:09.123456789 +0000 (UTC) 24");
+    ASSERT_EQ(fmt::vformat("{:%a, %d %b %Y %H:%M:%S.%f %z (%Z) %y}", time), "Tue, 05 Mar 2024 13:04:09.123456789 +0000 (UTC) 24");
+
+    ASSERT_EQ(fmt::format<"{} {} {} {}">(42ms, 5min, duration<double>(1.5), duration<int, std::ratio<1, 30>>(3)), "42ms 5min 1.5s 3[1/30]s");
+    ASSERT_EQ(fmt::vformat("{:%F %f} {1:>6}", time, 42ms), "2024-03-05 123456789   42ms");
+    ASSERT_THROW(fmt::vformat("{:%Q}", time), std::invalid_argument);
+}
+
+TEST(StaticFormat, Scan)
+{
+    int id;
+    unsigned flags;
+    double ratio;
+    std::string name;
+    std::string_view tag;
+    ASSERT_TRUE(fmt::scan<"{}:{1:x} {2} [{3}] <{4:>6}>">("-12:0xff 3.5 [hello world] <    ab>", id, flags, ratio, name, tag));
+    ASSERT_EQ(id, -12);
+    ASSERT_EQ(flags, 255);
+    ASSERT_EQ(ratio, 3.5);
+    ASSERT_EQ(name, "hello world");
+    ASSERT_EQ(tag, "ab");
+
+    // what format writes, scan reads back
+    auto line = fmt::format<"{:+} {1:#010x} {2:b} {3:o} {4:e} {5:*^7}|">(42, 27u, 5, 8, 1234.5, -3);
+    int sign, binary, octal, padded;
+    unsigned hex;
+    double real;
+    ASSERT_TRUE(fmt::scan<"{:+} {1:#010x} {2:b} {3:o} {4:e} {5:*^7}|">(line, sign, hex, binary, octal, real, padded));
+    ASSERT_EQ(std::make_tuple(sign, hex, binary, octal, real, padded), std::make_tuple(42, 27u, 5, 8, 1234.5, -3));
+    // a width without an align pads on the right, numbers included
+    line = fmt::format<"{:5}|{1:6}|{2:4}|">(15, 2.5, "ab");
+    ASSERT_EQ(line, "15   |2.5   |ab  |");
+    ASSERT_TRUE(fmt::scan<"{:5}|{1:6}|{2:4}|">(line, id, real, name));
+    ASSERT_EQ(std::make_tuple(id, real, name), std::make_tuple(15, 2.5, std::string("ab")));
+
+    for (double value : {3.0, -0.15625, 1e300})
+    {
+        ASSERT_TRUE(fmt::scan<"{:x} {1:X}">(fmt::format<"{:x} {0:X}">(value), real, ratio));
+        ASSERT_EQ(real, value);
+        ASSERT_EQ(ratio, value);
+    }
+
+    auto result = fmt::scan<"{}-{}">("5-x", id, flags);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.position, 2);
+    ASSERT_EQ(result.count, 1);
+
+    signed char small;
+    ASSERT_TRUE(fmt::scan<"{}">("-128", small));
+    ASSERT_EQ(small, -128);
+    ASSERT_FALSE(fmt::scan<"{}">("128", small));
+    ASSERT_FALSE(fmt::scan<"{}">("-1", flags));
+    ASSERT_FALSE(fmt::scan<"a{}">("b1", id));
+}
+
+TEST(RuntimeFormat, All)
+{
+    string pattern = "{1} to see you, {0}";
+    ASSERT_EQ(fmt::vformat(pattern, "Mu00", "Nice"), "Nice to see you, Mu00");
+    ASSERT_EQ(fmt::vformat("{{{}} {:>1$}|{2:#010x}|{3:.2}", 7, 4, 27, 3.14159), "{7}    7|0x0000001b|3.14");
+    ASSERT_EQ(fmt::vformat("{}", std::vector{1, 2}), "{1, 2}");
+
+    string str = "> ";
+    ASSERT_EQ(fmt::vformat_into(str, "{}!", "Hello"), "> Hello!");
+
+    ASSERT_THROW(fmt::vformat("{} {}", 1), std::invalid_argument);
+    ASSERT_THROW(fmt::vformat("{:.2}", 1), std::invalid_argument);
+    ASSERT_THROW(fmt::vformat("{:1$}", 1, "x"), std::invalid_argument);
+    ASSERT_THROW(fmt::vformat("{:<}", 1), std::invalid_argument);
+    ASSERT_THROW(fmt::vformat("{", 1), std::invalid_argument);
+}
+
+TEST(RuntimeFormat, Cache)
+{
+    fmt::set_pattern_cache_capacity(2);
+    for (int i = 0; i < 3; ++i)
+    {
+        ASSERT_EQ(fmt::vformat("a{}", i), "a" + to_string(i));
+        ASSERT_EQ(fmt::vformat("b{}", i), "b" + to_string(i));
+        ASSERT_EQ(fmt::vformat("c{}", i), "c" + to_string(i));
+    }
+    ASSERT_EQ(fmt::details::pattern_cache().get("c{}"), fmt::details::pattern_cache().get("c{}"));
+
+    fmt::set_pattern_cache_capacity(0);
+    ASSERT_EQ(fmt::vformat("a{}", 1), "a1");
+    fmt::set_pattern_cache_capacity(256);
+}
+
 template<fmt::details::FixedString pattern, typename ...Args>
 string print_v(Args &&...args)
 {
@@ -96,6 +669,284 @@ TEST(StaticPrint, All)
 {
     ASSERT_EQ(print_v<"Hello, {}!">("world"), "Hello, world!");
     ASSERT_EQ(print_v<"The number is {}">(42), "The number is 42");
+    ASSERT_EQ(print_v<"{{{:>4}}">(7), "{   7}");
+}
+
+TEST(StaticPrint, File)
+{
+    auto file = std::tmpfile();
+    ASSERT_EQ(fmt::print<"{}-{1:#x}\n">(file, "id", 255), 0);
+    std::rewind(file);
+
+    char line[16] {};
+    ASSERT_NE(std::fgets(line, sizeof(line), file), nullptr);
+    ASSERT_STREQ(line, "id-0xff\n");
+    std::fclose(file);
+}
+
+TEST(StaticPrint, Stream)
+{
+    std::ostringstream os;
+    ASSERT_EQ(fmt::print<"{} + {} = {}">(os, 1, 2, 3), 0);
+    ASSERT_EQ(fmt::print<"; {}">(os, std::vector{4, 5}), 0);
+    ASSERT_EQ(os.str(), "1 + 2 = 3; {4, 5}");
+}
+
+// more placeholders than one writev takes
+constexpr auto many_segments = []()
+{
+    fmt::fixed_string<4 * 1000 + 1> pattern;
+    for (std::size_t i = 0; i < 1000; ++i)
+    {
+        pattern.data[4 * i] = '{';
+        pattern.data[4 * i + 1] = '0';
+        pattern.data[4 * i + 2] = '}';
+        pattern.data[4 * i + 3] = ',';
+    }
+    return pattern;
+}();
+
+TEST(StaticPrint, Write)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    // larger than the pipe buffer, so the writer waits on the reader
+    std::string text(1 << 20, 'x');
+    std::string received;
+    std::thread reader([&]
+    {
+        char buffer[4096];
+        for (ssize_t size; (size = read(fds[0], buffer, sizeof(buffer))) > 0; )
+        {
+            received.append(buffer, size);
+        }
+    });
+
+    ASSERT_EQ(fmt::write<"[{}] {1:>4}|{2:#x} {3}\n">(fds[1], "INFO", "ab", 255u, std::vector{1, 2}), 0);
+    ASSERT_EQ(fmt::write<"{}\n">(fds[1], text), 0);
+    ASSERT_EQ(fmt::write<many_segments>(fds[1], 7), 0);
+    ASSERT_EQ(fmt::write<"{:?} {0:j}\n">(fds[1], "a\"b\n"), 0);
+    close(fds[1]);
+    reader.join();
+    close(fds[0]);
+
+    std::string many;
+    for (int i = 0; i < 1000; ++i)
+    {
+        many += "7,";
+    }
+    ASSERT_EQ(received, "[INFO]   ab|0xff {1, 2}\n" + text + "\n" + many + "\"a\\\"b\\n\" \"a\\\"b\\n\"\n");
+    ASSERT_EQ(fmt::write<"{}">(-1, "x"), EBADF);
+}
+
+TEST(AsyncLogger, Ordered)
+{
+    auto file = std::tmpfile();
+    {
+        fmt::async_logger logger(file, 4);
+        std::string name = "temporary";
+        ASSERT_TRUE(logger.log<"{}: {}\n">(name, 1));
+        name = "overwritten";
+        for (int i = 2; i <= 100; ++i)
+        {
+            ASSERT_TRUE(logger.log<"{}: {1:>3}\n">("line", i));
+        }
+        ASSERT_TRUE((logger.log<"{}\n">(std::array<long, 32> {})));
+        logger.flush();
+    }
+    std::rewind(file);
+
+    char line[128] {};
+    ASSERT_NE(std::fgets(line, sizeof(line), file), nullptr);
+    ASSERT_STREQ(line, "temporary: 1\n");
+    for (int i = 2; i <= 100; ++i)
+    {
+        ASSERT_NE(std::fgets(line, sizeof(line), file), nullptr);
+        ASSERT_EQ(line, fmt::format<"line: {:>3}\n">(i));
+    }
+    ASSERT_NE(std::fgets(line, sizeof(line), file), nullptr);
+    ASSERT_EQ(line[0], '{');
+    std::fclose(file);
+}
+
+// more than one batch of output, written by flush and then by the destructor
+TEST(AsyncLogger, LargeBatches)
+{
+    std::string line(2000, 'x');
+    auto file = std::tmpfile();
+    {
+        fmt::async_logger logger(file, 256);
+        for (int i = 0; i < 200; ++i)
+        {
+            ASSERT_TRUE(logger.log<"{:>4} {1}\n">(i, line));
+        }
+        logger.flush();
+        ASSERT_EQ(std::ftell(file), 200 * 2006);
+        for (int i = 0; i < 200; ++i)
+        {
+            ASSERT_TRUE(logger.log<"{:>4} {1}\n">(i, line));
+        }
+    }
+    std::fseek(file, 0, SEEK_END);
+    ASSERT_EQ(std::ftell(file), 400 * 2006);
+    std::fclose(file);
+}
+
+TEST(AsyncLogger, Buffers)
+{
+    auto file = std::tmpfile();
+    {
+        fmt::async_logger logger(file, 4);
+        for (auto word : {"first", "second"})
+        {
+            char buffer[16];
+            std::strcpy(buffer, word);
+            ASSERT_TRUE(logger.log<"{} {}\n">(buffer, "literal"));
+            std::strcpy(buffer, "CHANGED");
+        }
+        char raw[4] = {'a', 'b', 'c', 'd'};
+        ASSERT_TRUE(logger.log<"{}\n">(raw));
+        raw[0] = 'x';
+    }
+    std::rewind(file);
+
+    char text[64] {};
+    ASSERT_EQ(std::fread(text, 1, sizeof(text) - 1, file), 34);
+    ASSERT_STREQ(text, "first literal\nsecond literal\nabcd\n");
+    std::fclose(file);
+}
+
+TEST(AsyncLogger, Overflow)
+{
+    auto file = std::tmpfile();
+    int logged = 0;
+    fmt::async_logger logger(file, 2, fmt::overflow_policy::drop_and_count);
+    std::vector<std::thread> threads;
+    std::atomic<int> accepted = 0;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&]()
+        {
+            for (int i = 0; i < 1000; ++i)
+            {
+                accepted += logger.log<"{}\n">(i);
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    logger.flush();
+
+    std::rewind(file);
+    char line[16];
+    while (std::fgets(line, sizeof(line), file))
+    {
+        ++logged;
+    }
+    ASSERT_EQ(logged, accepted);
+    ASSERT_EQ(accepted + logger.dropped(), 4000u);
+    std::fclose(file);
+}
+
+// heap allocations made by this thread while an allocation scope is open
+struct AllocationCount
+{
+    std::size_t count = 0;
+    std::size_t bytes = 0;
+};
+
+thread_local AllocationCount *allocation_scope = nullptr;
+
+void *operator new(std::size_t size)
+{
+    if (allocation_scope)
+    {
+        ++allocation_scope->count;
+        allocation_scope->bytes += size;
+    }
+    if (auto p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+// what call allocates once it is warm, i.e. once the per-thread buffers,
+// the pattern cache and the statistics of its patterns exist
+AllocationCount count_allocations(const std::function<void()> &call)
+{
+    call();
+    AllocationCount count;
+    allocation_scope = &count;
+    call();
+    allocation_scope = nullptr;
+    return count;
+}
+
+struct AllocationBudget
+{
+    const char *name;
+    std::function<void()> call;
+    std::size_t count;
+    std::size_t bytes;
+};
+
+// a change which makes any of these allocate more has to update the budget here
+TEST(Allocations, Budget)
+{
+    using namespace std::chrono;
+
+    std::string out;
+    out.reserve(1 << 12);
+    std::string text = "a string too long for the small string buffer";
+    std::vector<int> numbers = {1, 22, 333, 4444};
+    std::map<int, std::string> words = {{1, "one"}, {2, "two"}};
+    std::tuple<int, std::string, double> record = {42, "answer", 0.5};
+    std::vector<unsigned char> bytes(64, 0xa5);
+    sys_time<microseconds> time = sys_days{2024y / March / 5} + 13h + 123456us;
+    std::FILE *null_file = std::fopen("/dev/null", "w");
+    int null_fd = fileno(null_file);
+
+    AllocationBudget budgets[] = {
+        {"integers", [&] { out.clear(); fmt::format_into<"{} {1:x} {2:>8} {3:+05}">(out, 42, 255u, -7, 3); }, 0, 0},
+        {"floats", [&] { out.clear(); fmt::format_into<"{} {1:.3} {2:e} {3:>10.2}">(out, 0.1, 3.14159, 1234.5, 2.5); }, 0, 0},
+        {"strings", [&] { out.clear(); fmt::format_into<"{} {} {} {:>60}">(out, "literal", text, std::string_view(text), text.c_str()); }, 0, 0},
+        {"containers", [&] { out.clear(); fmt::format_into<"{} {1:>4} {2}">(out, numbers, words, record); }, 0, 0},
+        {"width arguments", [&] { out.clear(); fmt::format_into<"{:>1$}|{2:.3$}|{4:^1$}">(out, 7, 12, 3.14159, 2, "x"); }, 0, 0},
+        {"hex dump", [&] { out.clear(); fmt::format_into<"{:x} {0:X}">(out, bytes); }, 0, 0},
+        {"formatter types", [&] { out.clear(); fmt::format_into<"{} {1:>8c} {2} {3}">(out, Price{1234}, Price{5}, time, 42ms); }, 0, 0},
+        {"lazy", [&] { out.clear(); fmt::format_into<"{} {0:>70}">(out, fmt::lazy<"{} {}">(text, 42)); }, 0, 0},
+        {"escaped", [&] { out.clear(); fmt::format_into<"{:j} {0:?}">(out, text); }, 0, 0},
+        {"runtime pattern", [&] { out.clear(); fmt::vformat_into(out, "{} {:>1$} {2:x}", 42, 8, 255u); }, 0, 0},
+        {"format short", [&] { fmt::format<"{}">(42); }, 0, 0},
+        {"format long", [&] { fmt::format<"{}: {}">(42, text); }, 1, 50},
+        {"format integers", [&] { fmt::format<"{} {}">(-1234567LL, 89u); }, 0, 0},
+        {"format static", [&] { fmt::format_static<"id={:#010x} {1:>5}">(27u, -12); }, 0, 0},
+        {"print", [&] { fmt::print<"{} {} {}\n">(null_file, 42, text, numbers); }, 0, 0},
+        {"write", [&] { fmt::write<"{} {} {}\n">(null_fd, 42, text, numbers); }, 0, 0},
+    };
+
+    for (auto &budget : budgets)
+    {
+        SCOPED_TRACE(budget.name);
+        auto count = count_allocations(budget.call);
+        EXPECT_EQ(count.count, budget.count);
+        EXPECT_EQ(count.bytes, budget.bytes);
+    }
+    std::fclose(null_file);
 }
 
 int main(int argc, char *argv[])
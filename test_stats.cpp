@@ -0,0 +1,38 @@
+// every call is recorded here, while test.cpp covers the uninstrumented path;
+// the macro has to agree across a program, so this is a program of its own
+#define FMT_ENABLE_STATS
+#include "format.hpp"
+#include <string>
+#include <algorithm>
+#include <gtest/gtest.h>
+
+TEST(Stats, Record)
+{
+    std::string out;
+    for (int i = 0; i < 3; ++i)
+    {
+        fmt::format_into<"stats \"{}\"\n">(out, i * 500);
+    }
+
+    auto stats = fmt::stats();
+    auto it = std::find_if(stats.begin(), stats.end(), [](auto &entry) { return entry.pattern == "stats \"{}\"\n"; });
+    ASSERT_NE(it, stats.end());
+    ASSERT_EQ(it->calls, 3);
+    ASSERT_EQ(it->total_bytes, out.size());
+    ASSERT_EQ(it->max_bytes, 13);
+    ASSERT_GE(it->allocations, 1);
+
+    ASSERT_NE(fmt::dump_stats().find("         3           35         13"), std::string::npos);
+    ASSERT_NE(fmt::dump_stats(fmt::stats_format::json).find(
+        "{\"pattern\": \"stats \\\"{}\\\"\\n\", \"calls\": 3, \"total_bytes\": 35, \"max_bytes\": 13"), std::string::npos);
+
+    fmt::reset_stats();
+    stats = fmt::stats();
+    ASSERT_TRUE(std::all_of(stats.begin(), stats.end(), [](auto &entry) { return entry.calls == 0; }));
+}
+
+int main(int argc, char *argv[])
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}